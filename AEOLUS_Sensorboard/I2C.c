@@ -4,6 +4,10 @@
  * This file handels the communication over I2C. It writes and reads bytes from the I2C. 
  * Note: ATMEL calls the I2C bus TWI (Two wire interface). 
  *
+ * The transfers are driven by the TWI-Interrupt: A transaction (address, bytes to write, number of 
+ * bytes to read) is queued using I2C_submit() and executed in the background. The CPU is free for 
+ * other tasks while the bus is busy. 
+ *
  * It is assumed that the processor is the Slave that controlls a Slave 
  *
  * Note: This code is partly based on the code from  Peter Fleury <pfleury@gmx.ch>
@@ -16,14 +20,18 @@
 #include "config.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <compat/twi.h>
+#include <util/atomic.h>
 
 #include "I2C.h"
 #include "port.h"
+#include "timer.h"
 //#include "serial.h"
 
-#include <avr/delay.h>
+#include <util/delay.h>
 
 
 
@@ -71,218 +79,491 @@
 
 
 
-#define BITRATE 100000L		//100kHz maximum Bitrate
-#define TIMEOUT 100         //Number or times I2C retries to get a connection before a timeout occures => prevents the I2C from beeing blocking 
-static uint8_t timeout = 0; //Number of times I2C actually tried to get a connection 
+#define TIMEOUT_US 5000		//Maximum duration of a transaction [us] => a stuck bus or a missing slave can not block the bus 
+#define MAX_RETRIES 20		//Number of times the address is resent, if the slave does not acknowledge (busy slave) 
+#define QUEUE_LENGTH 4		//Maximum number of transactions waiting to be executed 
+
+//Pins of the bus (used as normal port pins for bus recovery) 
+#define SDA PC4
+#define SCL PC5
+#define RECOVERY_PULSES 9	//Number of clock pulses needed to release a slave that holds SDA low 
+
+
+static struct {
+	I2C_transaction *queue[QUEUE_LENGTH];	//Transactions waiting to be executed (the first one is running on the bus)
+	uint8_t head;							//Position where the next transaction is queued 
+	uint8_t tail;							//Position of the transaction currently running 
+	uint8_t count;							//Number of transactions in the queue 
+	uint8_t index;							//Number of bytes already written or read in the current phase 
+	bool reading;							//true, iff the current transaction is in its read-phase 
+	uint8_t retries;						//Number of times the slave did not acknowledge its address 
+	uint32_t started;						//Time the current transaction was started [us] 
+} engine = {
+	.head = 0, 
+	.tail = 0, 
+	.count = 0
+};
+
+
+
+/************************************************************************/
+/* F U N C T I O N    P R O T O T Y P E S                               */
+/************************************************************************/
+
+/* @brief Send a START condition for the transaction at the tail of the queue */ 
+static void start(void); 
+
+/* @brief Finish the current transaction and start the next one */ 
+static void finish(I2C_status status); 
+
+/* @brief Free a stuck bus by clocking out SCL pulses followed by a STOP */ 
+static void recover(void); 
+
+
+
+
+/************************************************************************/
+/* P U B L I C     F U N C T I O N S                                    */
+/************************************************************************/
 
 /**
  * Init the use of I2C 
  *
+ * The SCL frequency is F_CPU/(16 + 2*TWBR*prescaler). The smallest prescaler (1,4,16,64) is chosen 
+ * for which TWBR fits into 8bit. TWBR is rounded up, such that the bus is never clocked faster than requested. 
+ *
  * @param bitrate [Hz]
- * @return false, if Bitrate is too high 
+ * @return false, if the Bitrate can not be reached with the current F_CPU (the TWI-Module is not enabled then)
  */ 
 bool I2C_init(uint32_t bitrate) {
 	
-	//Init the I2C bitrate and prescaler   
-	TWSR = 0;                       //no prescaler => presaclaer = 1
-	TWBR = ((F_CPU/BITRATE)-16)/2;  //should be >10 for stable operation 
+	//Check if the Bitrate is reachable at all: 
+	//Fast-mode is the maximum, and even with TWBR = 0 the SCL frequency is only F_CPU/16 
+	if(bitrate == 0 || bitrate > I2C_BITRATE_FAST || bitrate > F_CPU/16) {
+		return false; 
+	}
 	
-	//Check if TWBR is high enough (>10)
-	if(TWBR>10) {
-		return true; 
-	}		
+	//Number of CPU-Cycles that have to be covered by TWBR and the prescaler 
+	uint32_t cycles = (F_CPU + bitrate - 1)/bitrate - 16;	//F_CPU/bitrate rounded up 
 	
-	//Some error occured => return false 	
+	//A slave might still hold the bus from before a reset => release it 
+	recover(); 
+	
+	//Find the smallest prescaler for which TWBR fits into 8bit (TWPS = 0..3 <=> prescaler = 1,4,16,64)  
+	for(uint8_t twps = 0; twps < 4; twps++) {
+		
+		uint16_t div = 2 << (2*twps);						//2*prescaler 
+		uint32_t twbr = (cycles + div - 1)/div;			//Rounded up => SCL is never too fast 
+		
+		if(twbr <= 0xFF) {
+			//Found a valid setting => init the I2C bitrate and prescaler 
+			
+			TWSR = twps;						//Prescaler bits TWPS1:0
+			TWBR = (uint8_t)twbr;
+	
+			//Enable the TWI-Module and its interrupt
+			TWCR = (1<<TWEN) | (1<<TWIE); 
+			
+			return true; 
+		}
+	}
+	
+	//The Bitrate is too low to be reached even with the largest prescaler => return false 	
 	return false;
 }
 
 
 
-/** 
- * Start the I2C Master 
+
+/**
+ * Queue a transaction. The transaction is executed in the background by the TWI-Interrupt. 
+ * The status of the transaction is I2C_PENDING until it is completed. 
  *
- * @param address: 7bit slave address 
- * @param access: read or write (1 = read, 0 = write) 
+ * @param transaction: Descriptor of the transaction (must stay valid until completed) 
+ * @return false, if the queue is full 
  */
-bool I2C_start(uint8_t address, uint8_t access) {
-	
-	timeout = 0; //Reset the number of retries 
+bool I2C_submit(I2C_transaction *transaction) {
 	
-	uint8_t   twst;
+	bool ret = false; 
 	
-	//serial_send_string(" I2C Start...\n"); 
-
-	while(true) {
-
-		// send START condition
-		TWCR = (1<<TWINT) | (1<<TWSTA) | (1<<TWEN);
-
-		// wait until transmission completed
-		while(!(TWCR & (1<<TWINT))) {
-			timeout++; 
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		
+		if(engine.count < QUEUE_LENGTH) {
+			//There is space in the queue => add the transaction 
+			
+			transaction->status = I2C_PENDING; 
 			
-			if(timeout>TIMEOUT) {
-				return false; 
+			engine.queue[engine.head] = transaction; 
+			engine.head = (engine.head + 1) % QUEUE_LENGTH; 
+			engine.count++; 
+			
+			if(engine.count == 1) {
+				//The bus is idle => start the transaction right away 
+				
+				start(); 
 			}
+			
+			ret = true; 
 		}
-		
-		//serial_send_string("   transmission completed"); 
+	}
+	
+	return ret; 
+}
 
-		// check value of TWI Status Register. Mask prescaler bits.
-		twst = TW_STATUS & 0xF8;
-		if ( (twst != TW_START) && (twst != TW_REP_START)) return false;
 
-		//send device address
-		//address = address | access;
-		TWDR = ((address<<1) | access);
-		TWCR = (1<<TWINT) | (1<<TWEN);
 
-		// wail until transmission completed and ACK/NACK has been received
-		while(!(TWCR & (1<<TWINT))){
-			timeout++;
-			
-			if(timeout>TIMEOUT) {
-				return false;
-			}
-		}
-		
-		//serial_send_string("   ACK/NACK received"); 
+/**
+ * Check if the bus is busy
+ *
+ * @return true, as long as any transaction is queued or running 
+ */
+bool I2C_is_busy(void) {
+	
+	return engine.count > 0; 
+}
 
-		// check value of TWI Status Register. Mask prescaler bits.
-		twst = TW_STATUS & 0xF8;	
+
+
+/**
+ * Wait until a transaction is completed 
+ * Note: Interrupts must be enabled. The waiting time is bounded by the timeout of the queued transactions. 
+ *
+ * @param transaction: Descriptor of a submitted transaction 
+ * @return true, iff the transaction was successful 
+ */
+bool I2C_wait(I2C_transaction *transaction) {
 	
-		if ( (twst == TW_MT_SLA_NACK )||(twst ==TW_MR_DATA_NACK) ) {
-			//We received NACK => the device is busy => we continue polling it 
-			//serial_send_string("   LIDAR busy!");
-			
-			//device busy, send stop condition to terminate write operation
-			TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
+	while(transaction->status == I2C_PENDING) {
+		//The transaction is executed by the interrupt => only check for a timeout 
 		
-			// wait until stop condition is executed and bus released
-			while(TWCR & (1<<TWSTO)) {
-				timeout++;
-				
-				if(timeout>TIMEOUT) {
-					return false;
-				}
-			}				
-		
-			continue;
-		}
-		//serial_send_string(" ...start OK! ");
-
-		break;
+		I2C_handler(); 
 	}
-
-	//serial_send_string("...end!\n"); 
-	return true;
+	
+	return transaction->status == I2C_DONE; 
 }
 
 
 
 /**
- * Stop the I2C Master 
- *
+ * Handle repetitive tasks: Abort a transaction that takes longer than the timeout. 
+ * The bus is recovered and the next transaction in the queue is started. 
+ * Note: This function should be called in every program loop 
  */
-void I2C_stop(void) {
+void I2C_handler(void) {
 	
-	timeout = 0; //Reset the number of retries 
+	bool timeout = false; 
 	
-    //Send Stop condition 
-    TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWSTO);
-    
-    // wait until stop condition is executed and bus released
-    while(TWCR & (1<<TWSTO)) {
-		timeout++;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		
-		if(timeout>TIMEOUT) {
-			return false;
+		if(engine.count > 0 && (timer_get_us() - engine.started) > TIMEOUT_US) {
+			//The transaction timed out => the slave or the bus is stuck 
+			//Disable the TWI-Interrupt, such that the interrupt can not finish the transaction in the meantime 
+			//Note: TWINT is written as zero => a pending interrupt flag is not cleared 
+			
+			TWCR = (1<<TWEN); 
+			timeout = true; 
 		}
 	}
-}	
+	
+	if(timeout) {
+		//The recovery takes about 100us => it is done with interrupts enabled (UART and system timer keep running) 
+		recover(); 
+		
+		//finish() enables the TWI-Interrupt again 
+		finish(I2C_ERROR); 
+	}
+}
 
 
 
 /**
- * Write a Byte to the slave 
+ * Write bytes to a slave and then read bytes from it. Both phases are done in one transfer, 
+ * separated by a repeated START (no STOP in between). The last byte read is answered with a NACK. 
+ * This function blocks until the transfer is completed. 
  *
- * @param bytes 
+ * @param address: 7bit slave address 
+ * @param tx: Bytes to be written 
+ * @param txlen: Number of bytes to be written (0 => only read)
+ * @param rx: Buffer for the bytes read 
+ * @param rxlen: Number of bytes to be read (0 => only write) 
+ * @return true, iff the transfer was successful 
  */
-bool I2C_write_byte(uint8_t byte) {
+bool I2C_transfer(uint8_t address, const uint8_t *tx, uint8_t txlen, uint8_t *rx, uint8_t rxlen) {
 	
-	timeout = 0; //Reset the number of retries 
+	I2C_transaction t = {
+		.address = address, 
+		.tx_data = tx, 
+		.tx_length = txlen, 
+		.rx_data = rx, 
+		.rx_length = rxlen, 
+		.callback = NULL
+	};
 	
-	uint8_t   twst;
+	if(!I2C_submit(&t)) {
+		//The queue is full => the transfer can not be done 
+		
+		return false; 
+	}
 	
-	//Send data to the previously addressed device
-	TWDR = byte;
-	TWCR = (1<<TWINT)|(1<<TWEN);
+	return I2C_wait(&t); 
+}
+
+
+
+
+
+
+/************************************************************************/
+/* I N T E R R U P T    H A N D L E R S                                 */
+/************************************************************************/
+
+/**
+ * TWI Interrupt 
+ * This interrupt occurs as soon as the TWI-Module finished an action on the bus. 
+ * The state machine of the current transaction is driven by the TWI status code. 
+ */
+ISR(TWI_vect) {
 	
-	//serial_send_string("  write byte...");
+	I2C_transaction *t = engine.queue[engine.tail]; 
 	
-	//Wait until transmission completed
-	while (!(TWCR & (1<<TWINT))) {
-		timeout++;
-		
-		if(timeout>TIMEOUT) {
-			return false;
+	switch(TW_STATUS) {
+		case TW_START:
+		case TW_REP_START: {
+			//A START was sent => address the slave 
+			//Without any bytes to write, the transaction directly starts with the read-phase 
+			
+			if(t->tx_length == 0 && t->rx_length > 0) {
+				engine.reading = true; 
+			}
+			
+			TWDR = (t->address<<1) | (engine.reading ? TW_READ : TW_WRITE); 
+			TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE); 
+			
+			break; 
+		}
+		case TW_MT_SLA_ACK: 
+		case TW_MT_DATA_ACK: {
+			//The slave acknowledged => write the next byte 
+			
+			engine.retries = 0; 
+			
+			if(engine.index < t->tx_length) {
+				//There are bytes left to be written 
+				
+				TWDR = t->tx_data[engine.index++]; 
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE);
+			} else if(t->rx_length > 0) {
+				//All bytes are written => continue with the read-phase using a repeated START 
+				
+				engine.reading = true; 
+				engine.index = 0; 
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTA); 
+			} else {
+				//Nothing to be read => the transaction is completed 
+				
+				finish(I2C_DONE); 
+			}
+			
+			break; 
+		}
+		case TW_MR_SLA_ACK: {
+			//The slave acknowledged the read access => acknowledge all but the last byte 
+			
+			engine.retries = 0; 
+			
+			if(t->rx_length > 1) {
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWEA); 
+			} else {
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE); 
+			}
+			
+			break; 
+		}
+		case TW_MR_DATA_ACK: {
+			//A byte was received and acknowledged => store it
+			
+			t->rx_data[engine.index++] = TWDR; 
+			
+			if(engine.index < t->rx_length-1) {
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWEA);
+			} else {
+				//The next byte is the last one => respond with a NACK
+				
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE); 
+			}
+			
+			break; 
+		}
+		case TW_MR_DATA_NACK: {
+			//The last byte was received => the transaction is completed 
+			
+			t->rx_data[engine.index++] = TWDR; 
+			
+			finish(I2C_DONE); 
+			
+			break; 
+		}
+		case TW_MT_SLA_NACK: 
+		case TW_MR_SLA_NACK: {
+			//We received NACK => the device is busy => we continue polling it 
+			
+			engine.retries++; 
+			
+			if(engine.retries > MAX_RETRIES) {
+				//The slave does not respond at all => give up 
+				
+				finish(I2C_ERROR); 
+			} else {
+				//Send STOP followed by a new START and restart the transaction 
+				
+				engine.index = 0; 
+				engine.reading = false; 
+				TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTO) | (1<<TWSTA); 
+			}
+			
+			break; 
+		}
+		case TW_MT_ARB_LOST: {
+			//Some other master took the bus => retry as soon as the bus is free
+			
+			engine.index = 0; 
+			engine.reading = false;
+			TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTA);
+			
+			break; 
+		}
+		default: {
+			//A data byte was not acknowledged or a bus error occurred 
+			//Nothing we can do about this... release the bus and flag the transaction as failed 
+			
+			finish(I2C_ERROR); 
+			
+			break; 
 		}
 	}
-	
-	//serial_send_string("  byte written!"); 
+}
 
-	//Check value of TWI Status Register. Mask prescalor bits
-	twst = TWSR & 0xF8;
-	if (twst != TWI_MTX_DATA_ACK) {
-		return true;
-	}	
-		
-	return false;
+
+
+
+
+/************************************************************************/
+/* P R I V A T E     F U N C T I O N S                                  */
+/************************************************************************/
+
+/**
+ * Send a START condition for the transaction at the tail of the queue
+ * 
+ * Note: Must be called with interrupts disabled or from the interrupt
+ */
+static void start(void) {
+	
+	engine.index = 0; 
+	engine.reading = false; 
+	engine.retries = 0; 
+	engine.started = timer_get_us(); 
+	
+	TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTA); 
 }
 
 
+
 /**
- * Read Bytes from the Bus
+ * Finish the current transaction: Release the bus, notify the owner of the transaction 
+ * and start the next transaction in the queue 
  *
- * @return byte read
+ * Note: Must be called from the interrupt or with the TWI-Interrupt disabled (TWIE cleared). 
+ *       The TWI-Interrupt is enabled again afterwards. The callback is called in the same context. 
+ * 
+ * @param status: Final status of the transaction 
  */
-uint8_t I2C_read_byte(void) {
+static void finish(I2C_status status) {
 	
-	timeout = 0; //Reset the number of retries 
+	I2C_transaction *t = engine.queue[engine.tail]; 
 	
-	//serial_send_string("  read byte..."); 
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWEA);
-	while (!(TWCR & (1<<TWINT))) {
-		timeout++;
+	//Remove the transaction from the queue 
+	engine.tail = (engine.tail + 1) % QUEUE_LENGTH; 
+	engine.count--; 
+	
+	if(engine.count > 0) {
+		//More transactions are waiting => send STOP followed by a START 
 		
-		if(timeout>TIMEOUT) {
-			return false;
-		}
-	}
-
-	//serial_send_string("  byte read"); 
+		engine.index = 0;
+		engine.reading = false;
+		engine.retries = 0;
+		engine.started = timer_get_us(); 
+		
+		TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTO) | (1<<TWSTA); 
 
-	return TWDR;
+	} else {
+		//Send Stop condition and release the bus 
+		
+		TWCR = (1<<TWINT) | (1<<TWEN) | (1<<TWIE) | (1<<TWSTO); 
+	}
+	
+	//Notify the owner of the transaction 
+	t->status = status; 
+	
+	if(t->callback != NULL) {
+		t->callback(t); 
+	}
 }
 
 
+
 /**
- * Read the last byte from the slave 
- * 
- * @return last byte read
+ * Recover the bus, if a slave holds SDA low (e.g. after a reset of the master during a transfer). 
+ * The TWI-Module is disabled and SCL is clocked by hand until the slave releases SDA. 
+ * Then a STOP condition is generated and the TWI-Module is enabled again. 
+ *
+ * Note: The pins are driven like open-drain outputs: low = output low, high = input with pull-up 
+ *       Must be called with the TWI-Interrupt disabled (or before the TWI-Module is enabled), the TWCR bits 
+ *       TWEN and TWIE are restored afterwards 
  */
-uint8_t I2C_read_last_byte(void) {
+static void recover(void) {
+	
+	uint8_t twbr = TWBR; 
+	uint8_t twsr = TWSR; 
+	uint8_t twcr = TWCR & ((1<<TWEN) | (1<<TWIE)); 
 	
-	timeout = 0; //Reset the number of retries 
+	//Disable the TWI-Module => SDA and SCL are normal port pins 
+	TWCR = 0; 
 	
-	TWCR = (1<<TWINT)|(1<<TWEN);
-	while(!(TWCR & (1<<TWINT))) {
-		timeout++;
+	//Release SDA and SCL 
+	DDRC &= ~((1<<SDA) | (1<<SCL)); 
+	PORTC |= (1<<SDA) | (1<<SCL); 
+	_delay_us(5); 
+	
+	//Clock SCL until the slave releases SDA 
+	for(uint8_t i = 0; i < RECOVERY_PULSES && !(PINC & (1<<SDA)); i++) {
 		
-		if(timeout>TIMEOUT) {
-			return false;
-		}
+		PORTC &= ~(1<<SCL);			//SCL low 
+		DDRC |= (1<<SCL); 
+		_delay_us(5); 
+		
+		DDRC &= ~(1<<SCL);			//SCL high 
+		PORTC |= (1<<SCL); 
+		_delay_us(5); 
 	}
 	
-	return TWDR;
+	//Generate a STOP condition: SDA goes high while SCL is high 
+	PORTC &= ~((1<<SDA) | (1<<SCL));		//SCL low, then SDA low 
+	DDRC |= (1<<SCL); 
+	_delay_us(5); 
+	DDRC |= (1<<SDA); 
+	_delay_us(5); 
+	
+	DDRC &= ~(1<<SCL);						//SCL high 
+	PORTC |= (1<<SCL); 
+	_delay_us(5); 
+	
+	DDRC &= ~(1<<SDA);						//SDA high => STOP 
+	PORTC |= (1<<SDA); 
+	_delay_us(5); 
+	
+	//Restore the TWI-Module 
+	TWBR = twbr; 
+	TWSR = twsr; 
+	TWCR = twcr; 
+
 }
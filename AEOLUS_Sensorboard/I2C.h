@@ -12,23 +12,55 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-/* @brief Init the use of I2C */ 
-bool I2C_init(uint32_t bitrate); 
 
-/* @brief Start the I2C Interface as a Master */ 
-bool I2C_start(uint8_t address, uint8_t access); 
+/** Bitrate Profiles [Hz] */
+#define I2C_BITRATE_STANDARD 100000L	//Standard-mode 
+#define I2C_BITRATE_FAST     400000L	//Fast-mode (highest rate supported by the TWI-Module) 
 
-/* @brief Stop the I2C Interface as a Master */ 
-void I2C_stop(void); 
 
-/* @brief Write a Byte to the Slave */
-bool I2C_write_byte(uint8_t byte);
+/** State of an I2C transaction */
 
-/* @brief Read a Byte from the Slave */
-uint8_t I2C_read_byte(void);
+typedef enum {
+	I2C_IDLE,			//Transaction was not submitted yet
+	I2C_PENDING,		//Transaction is queued or currently running on the bus
+	I2C_DONE,			//Transaction completed successfully
+	I2C_ERROR			//Slave did not respond or an error occurred on the bus
+} I2C_status;
+
+
+/** Descriptor of a single I2C transaction
+ *  The bytes in tx_data are written first, then rx_length bytes are read into rx_data.
+ *  Note: The descriptor is owned by the caller and must stay valid until the transaction is completed! */
+typedef struct I2C_transaction_s {
+	uint8_t address;					//7bit slave address
+	const uint8_t *tx_data;				//Bytes to be written to the slave
+	uint8_t tx_length;					//Number of bytes to be written
+	uint8_t *rx_data;					//Buffer for the bytes read from the slave
+	uint8_t rx_length;					//Number of bytes to be read
+	void (*callback)(struct I2C_transaction_s *transaction);	//Called from the interrupt on completion (may be NULL)
+	volatile I2C_status status;			//State of the transaction
+} I2C_transaction;
+
+
+
+/* @brief Init the use of I2C */
+bool I2C_init(uint32_t bitrate);
+
+/* @brief Queue a transaction, it is executed in the background */
+bool I2C_submit(I2C_transaction *transaction);
+
+/* @brief Return true, as long as a transaction is running on the bus */
+bool I2C_is_busy(void);
+
+/* @brief Wait until a submitted transaction is completed */
+bool I2C_wait(I2C_transaction *transaction);
+
+/* @brief Handle repetitive tasks (abort transactions that timed out) */
+void I2C_handler(void);
+
+/* @brief Write and then read bytes in one transfer using a repeated START */
+bool I2C_transfer(uint8_t address, const uint8_t *tx, uint8_t txlen, uint8_t *rx, uint8_t rxlen);
 
-/* @brief Read the last byte from the Slave */
-uint8_t I2C_read_last_byte(void); 
 
 
 #endif /* I2C_H_ */
\ No newline at end of file
@@ -1,11 +1,18 @@
 /*
  * buffer.h
  *
- * This file holds public function definitions for the implementation of a circular Buffer 
+ * This file implements a statically allocated circular buffer for records of any type
+ *
+ * Note: head and tail count the added and removed records and overflow naturally, the index in the array
+ *       is taken using a mask (the number of records is a power of two). Therefore all records can be used.
+ *
+ * Note: The functions are generated by BUFFER_DEFINE for every buffer (inline, for its record type). The mask
+ *       and the size of a record are known at compile time => adding or getting a byte in an interrupt
+ *       is only a few instructions (no function call, no multiplication).
  *
  * Created: 04.05.2015 14:22:59
  *  Author: Jonas Wirz <wirzjo@student.ethz.ch>
- */ 
+ */
 
 
 #ifndef BUFFER_H_
@@ -15,36 +22,100 @@
 #include <stdbool.h>
 
 
-/** Struct for a Circluar Buffer */
-typedef struct {
-	uint16_t *bufferData1_p;		//Pointer to an Array containing the first column of Buffer-Data
-	uint16_t *bufferData2_p;		//Pointer to an Array containing the second column of Buffer Data
-	uint8_t head;					//Position of the head of the buffer (index in the array)
-	uint8_t tail;              		//Position of the tail of the buffer (index in the array)
-	uint8_t maxBuffersize;     		//Maximum possible Buffersize
-	uint8_t buffersize;        		//Current size of the buffer
-} CircularBuffer;
-
-
-
-/* @brief Create a new buffer of the given size */ 
-CircularBuffer buffer_init(uint8_t buffersize); 
-
-
-/* @brief Add values to the buffer */ 
-bool buffer_add(CircularBuffer *buffer, uint16_t value1, uint16_t value2); 
-
-
-/* @brief Return the values from a given position in the buffer */
-bool buffer_get_values(CircularBuffer *buffer, uint16_t *value1, uint16_t *value2); 
-
-
-/* @brief Return true, if the buffer is empty */ 
-bool buffer_is_empty(CircularBuffer *buffer); 
-
-
-/* @brief Return the size of the buffer */ 
-uint8_t buffer_get_size(CircularBuffer *buffer);
-
-
-#endif /* BUFFER_H_ */
\ No newline at end of file
+/** Compiler barrier: a record is stored (or read) completely before head (or tail) is moved */
+#define BUFFER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+
+/** Define a Circular Buffer holding length records of the given type and its functions:
+ *    name_init()           Empty the buffer
+ *    name_add(&record)     Add a record (false, if the buffer is full)
+ *    name_get(&record)     Remove the oldest record (false, if the buffer is empty)
+ *    name_peek(index)      Return a record without removing it (0 == oldest, NULL if there is none)
+ *    name_peek_n(records, n)  Copy up to n of the oldest records without removing them
+ *    name_pop_n(n)         Remove up to n of the oldest records
+ *    name_size()           Number of records in the buffer
+ *    name_free()           Number of records that can be added
+ *  One producer and one consumer (e.g. an interrupt and the main loop) can use the buffer without disabling
+ *  interrupts: head is only written by the producer (name_add), tail only by the consumer (all others).
+ *  Note: length must be a power of two and at most 128
+ *  Example: BUFFER_DEFINE(my_buffer, my_struct, 16); => my_buffer_add(&record); */
+#define BUFFER_DEFINE(name, type, length) \
+	typedef char name##_length_check[(((length) & ((length) - 1)) == 0 && (length) <= 128) ? 1 : -1]; \
+	\
+	static struct { \
+		type records[(length)];		/* Array holding the records */ \
+		volatile uint8_t head;		/* Number of records added (index in the array = head & mask) */ \
+		volatile uint8_t tail;		/* Number of records removed (index in the array = tail & mask) */ \
+	} name; \
+	\
+	static inline void name##_init(void) { \
+		name.head = 0; \
+		name.tail = 0; \
+	} \
+	\
+	static inline uint8_t name##_size(void) { \
+		return (uint8_t)(name.head - name.tail); \
+	} \
+	\
+	static inline uint8_t name##_free(void) { \
+		return (length) - name##_size(); \
+	} \
+	\
+	static inline bool name##_add(const type *record) { \
+		uint8_t head = name.head; \
+		if((uint8_t)(head - name.tail) >= (length)) { \
+			return false; \
+		} \
+		name.records[head & ((length) - 1)] = *record; \
+		BUFFER_BARRIER(); \
+		name.head = head + 1; \
+		return true; \
+	} \
+	\
+	static inline bool name##_get(type *record) { \
+		uint8_t tail = name.tail; \
+		if(tail == name.head) { \
+			return false; \
+		} \
+		BUFFER_BARRIER(); \
+		*record = name.records[tail & ((length) - 1)]; \
+		BUFFER_BARRIER(); \
+		name.tail = tail + 1; \
+		return true; \
+	} \
+	\
+	static inline const type *name##_peek(uint8_t index) { \
+		if(index >= name##_size()) { \
+			return 0; \
+		} \
+		BUFFER_BARRIER(); \
+		return &name.records[(uint8_t)(name.tail + index) & ((length) - 1)]; \
+	} \
+	\
+	static inline uint8_t name##_peek_n(type *records, uint8_t n) { \
+		uint8_t size = name##_size(); \
+		uint8_t tail = name.tail; \
+		if(n > size) { \
+			n = size; \
+		} \
+		BUFFER_BARRIER(); \
+		for(uint8_t i = 0; i < n; i++) { \
+			records[i] = name.records[(uint8_t)(tail + i) & ((length) - 1)]; \
+		} \
+		return n; \
+	} \
+	\
+	static inline uint8_t name##_pop_n(uint8_t n) { \
+		uint8_t size = name##_size(); \
+		if(n > size) { \
+			n = size; \
+		} \
+		BUFFER_BARRIER(); \
+		name.tail = name.tail + n; \
+		return n; \
+	} \
+	\
+	typedef char name##_end	/* Requires the semicolon after BUFFER_DEFINE(...) */
+
+
+#endif /* BUFFER_H_ */
@@ -13,27 +13,123 @@
 
 #include "buffer.h"
 
-/** INTERVAL []
- * Angle between two distance measurements in degrees (smallest interval possible is 1, integer types only) */ 
-#define INTERVAL 2 
+/** ANGLE RESOLUTION 
+ * Angles are fixed-point numbers in 1/ANGLE_RES degrees (10 => 0.1). DEG() converts degrees to this unit */ 
+#define ANGLE_RES 10
+#define DEG(deg) ((deg)*ANGLE_RES)
+
+/** INTERVAL [1/ANGLE_RES ]
+ * Angle between two distance measurements (smallest interval possible is 1/ANGLE_RES degrees) */ 
+#define INTERVAL DEG(2) 
 
 /** RANGE []
  * Angle between boat middle axis and end of sector for measurement */ 
 #define RANGE 90 
 
+/** SECTOR WIDTH [1/ANGLE_RES ] 
+ * The scan is divided into sectors of this width (multiple of INTERVAL). A sector is pushed to the Pixhawk as soon as 
+ * the scan leaves it (if the Pixhawk subscribed to it) */ 
+#define SECTOR_WIDTH DEG(30)
+
+/** STORE SIGNAL 
+ * Keep the signal strength of every measurement in the small Matrix (1 == stored, needs DEG(2*RANGE)/INTERVAL bytes of RAM) */ 
+#define STORE_SIGNAL 0
+
 
 /** CPU-Frequency [Hz] */
 #define F_CPU 8000000L 
 
 
+/** MEASUREMENT MODE 
+ * MEASURE_STEP:  the servo stops at every angle for the measurement 
+ * MEASURE_SWEEP: the servo sweeps continuously, every measurement gets the angle of the servo at the middle of its acquisition */ 
+#define MEASURE_STEP 0
+#define MEASURE_SWEEP 1
+#define MEASURE_MODE MEASURE_STEP
+
+/** SWEEP SPEED [/s] 
+ * Speed of the servo in the MEASURE_SWEEP mode */ 
+#define SWEEP_SPEED 90
+
+/** SWEEP RATE [Hz] 
+ * Measurements per second of the free-running LIDAR in the MEASURE_SWEEP mode (8..1000) */ 
+#define SWEEP_RATE 100
+
+
+/** SERVO FEEDBACK 
+ * Read the position of the servo from its potentiometer using the ADC (1 == feedback connected). 
+ * The measurement starts as soon as the servo is within FEEDBACK_TOLERANCE [1/ANGLE_RES ] of the angle and 
+ * the measurements are stored at the measured angle. 
+ * FEEDBACK_CHANNEL is the ADC channel (pin of PORTC), FEEDBACK_MIN and FEEDBACK_MAX are the ADC values at 0 and 180 
+ * A servo that does not reach the tolerance is considered settled FEEDBACK_TIMEOUT [ms] after its modeled arrival */ 
+#ifndef SERVO_FEEDBACK		//The host tests turn the feedback on 
+#define SERVO_FEEDBACK 0
+#endif
+#define FEEDBACK_CHANNEL 0
+#define FEEDBACK_MIN 100
+#define FEEDBACK_MAX 920
+#define FEEDBACK_TOLERANCE DEG(1)
+#define FEEDBACK_TIMEOUT 500
+
+
 /** LIDAR MAX DISTANCE RANGE [cm] 
  * Maximum Distance the LIDAR can measure. Above this distance the LIDAR returns zero */ 
 #define LIDAR_MAX_DISTANCE 700 //25m
 
 
+/** LIDAR MIN SIGNAL 
+ * Minimum signal strength of a valid measurement. Weaker returns are treated as if nothing was detected */ 
+#define LIDAR_MIN_SIGNAL 20
+
+
+/** FORWARD SECTOR []
+ * Half width of the sector around the bow, that is measured with the long-range (slow, sensitive) acquisition profile. 
+ * Outside of this sector the short-range (fast) profile is used */ 
+#define FORWARD_SECTOR 30
+
+
+/** LIDAR I2C FAST-MODE
+ * Communicate with the LIDAR using the 400kHz Fast-mode instead of the 100kHz Standard-mode (1 == Fast-mode) */
+#define LIDAR_FASTMODE 1
+
+
+/** LIDAR COUNT 
+ * Number of LIDAR sensors on the I2C bus. The sensors are mounted on the servo with an angular offset to each other, 
+ * so one sweep covers more than the range of the servo. Every sensor needs an entry in LIDAR_ENABLE_PINS and LIDAR_OFFSETS */ 
+#define LIDAR_COUNT 1
+
+/** LIDAR ENABLE PINS 
+ * Pins on PORTD connected to the power enable pins of the sensors. The sensors are powered on one after the other 
+ * at boot to give them their own I2C address (only used with more than one sensor) */ 
+#define LIDAR_ENABLE_PINS {4, 5}
+
+/** LIDAR OFFSETS []
+ * Mounting angle of each sensor added to the servo angle (0..359, the first sensor looks in the direction of the servo) */ 
+#define LIDAR_OFFSETS {0, 180}
+
+
+/** PIXHAWK OUTPUT 
+ * PIXHAWK_CUSTOM:  the Pixhawk requests the data using the protocol in pixhawk.c 
+ * PIXHAWK_MAVLINK: MAVLink v2 OBSTACLE_DISTANCE messages are sent after every sector, received data is ignored 
+ *                  (MAVLINK_SYSTEM_ID and MAVLINK_COMPONENT_ID are the ids of the sensorboard, 196 == MAV_COMP_ID_OBSTACLE_AVOIDANCE) */ 
+#define PIXHAWK_CUSTOM 0
+#define PIXHAWK_MAVLINK 1
+#ifndef PIXHAWK_OUTPUT			//The host test of the MAVLink message sets it 
+#define PIXHAWK_OUTPUT PIXHAWK_CUSTOM
+#endif
+#define MAVLINK_SYSTEM_ID 1
+#define MAVLINK_COMPONENT_ID 196
+
+
 /** MAX OBSTACLE NUMBER 
- * Maximum number of obstacles that can be stored */ 
-#define MAX_OBSTACLE_NUMBER 20
+ * Maximum number of obstacles that can be stored (at most 128). Only the closest ones are kept, every obstacle 
+ * needs 7 bytes of RAM */ 
+#define MAX_OBSTACLE_NUMBER 4
+
+/** OBSTACLE SCORE 
+ * Relevance of an obstacle (lower == more relevant). If the store is full, the obstacle with the highest score is dropped 
+ * and the obstacles are sent to the Pixhawk in the order of their score */ 
+#define OBSTACLE_SCORE(obst) ((obst)->distance)
 
 
 /** DEBUG FLAGS */
@@ -44,9 +140,5 @@
 
 
 
-/** COMMONLY USED VARIABLES */
-extern CircularBuffer obst_buffer; 
-
-
 
 #endif /* CONFIG_H_ */
\ No newline at end of file
@@ -4,13 +4,13 @@
  * This file handles the communication with the LIDAR sensor by using I2C in Master-Mode. 
  *
  * Note: The Sensor specifications are as follows: 
- *	-Bitrate: 100kHz
- *  -7bit Slave address: 0x62
+ *	-Bitrate: 100kHz (Standard-mode) or 400kHz (Fast-mode), see LIDAR_FASTMODE
+ *  -7bit Slave address: 0x62 (default, with more than one sensor every sensor gets a new address at boot) 
  *  -8bit Address for Write: 0xC4 => access-bit is 0
  *  -8bit Address for Read: 0xC5 => access-bit is 1
  *  -8 data bits + 1 ACK bit
  *  -A write operation is used both for read and write transfers 
- *  -If bit 7 of the register address to be read is 1, two consecutive registers are read 
+ *  -If bit 7 of the register address to be read is 1, consecutive registers are read (auto increment) 
  * 
  * Note: An example of the I2C protocol can be found on: 
  * https://github.com/kent-williams/LIDAR-Lite-DSS-I2C-Library-State-Machine/blob/master/LIDAR-Lite-DSS-I2C-Library-State-Machine/LIDAR-Lite-DSS-I2C-Library-State-Machine.ino
@@ -23,7 +23,12 @@
  */ 
 
 
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "lidar.h"
 #include "I2C.h"
+#include "timer.h"
 #include "config.h"
 #include <avr/delay.h>
 //#include "serial.h"
@@ -32,18 +37,50 @@
 /* V A R I A B L E S                                                    */
 /************************************************************************/
 
-#define BITRATE 100000L		//100kHz maximum Bitrate 
-#define SLAVE_ADDR 0x62		//Slave address 
+#if LIDAR_FASTMODE == 1
+	#define BITRATE I2C_BITRATE_FAST		//400kHz Fast-mode (supported by the LIDAR-Lite) 
+#else
+	#define BITRATE I2C_BITRATE_STANDARD	//100kHz Standard-mode 
+#endif
 
-#define WRITE 0			//Write access to the register 
-#define READ 1			//Read access to the register 
+#if F_CPU/BITRATE < 16
+	#error "The I2C Bitrate for the LIDAR can not be reached with the current F_CPU"
+#endif
 
+#define SLAVE_ADDR 0x62		//Default slave address 
+#define FIRST_ADDR 0x64		//Address assigned to the first sensor, if more than one sensor is used (the next ones get +2) 
+#define BURST_LENGTH 8		//Number of registers read per measurement (I_VELOCITY up to the low byte of I_DIST) 
 
-static struct {
-	uint16_t last_distance;		//Last measured distance 
-} state = {
-	.last_distance = 0
-};
+#define BOOT_TIME 25				//Time the sensor needs after power on or reset [ms] 
+#define ACQUISITION_TIMEOUT 50		//Maximum duration of a measurement [ms] 
+#define POLL_INTERVAL 500			//Minimum time between two reads of the status register [us] 
+
+#define STREAM_DELAY_RATE 2000		//Free-running rate [Hz] = STREAM_DELAY_RATE/(value of the delay register) 
+
+
+//State of a single sensor 
+typedef struct {
+	uint8_t address;				//7bit I2C address of the sensor 
+	lidar_sample last;				//Last measurement 
+	lidar_status status;			//State of the current measurement 
+	uint32_t triggered;				//Time the measurement was started [ms] 
+	uint32_t last_poll;				//Time the status register was read the last time [us] 
+	lidar_profile profile;			//Acquisition profile programmed into the sensor 
+	bool streaming;					//true, while the sensor is in free-running mode 
+	bool busy_seen;					//true, if the sensor was seen busy since the last free-running result was read 
+	uint32_t busy_since;			//Time the sensor was seen busy the first time [us] 
+	uint32_t acquired;				//Estimated middle of the last free-running acquisition [us] 
+	I2C_transaction transaction;	//Transaction used for the non-blocking measurement 
+	uint8_t tx[2];					//Bytes written by the transaction 
+	uint8_t rx[BURST_LENGTH];		//Bytes read by the transaction 
+} lidar_device; 
+
+static lidar_device devices[LIDAR_COUNT]; 
+
+#if LIDAR_COUNT > 1
+//Pins on PORTD connected to the power enable pins of the sensors 
+static const uint8_t enable_pins[] PROGMEM = LIDAR_ENABLE_PINS; 
+#endif
 
 
 
@@ -54,7 +91,28 @@ static struct {
 //INTERNAL REGISTERS (read and write) 
 #define I_COMMAND_REG 0x00		//Command control register => write commands to these register
 #define I_STATUS	  0x01		//Returns the status 
+#define I_SIG_COUNT   0x02		//Maximum acquisition count (higher => longer range, slower measurement) 
+#define I_ACQ_CONFIG  0x04		//Acquisition mode control 
+#define I_VELOCITY    0x09		//Returns the velocity [cm] (difference between the last two distances) 
+#define I_SIGNAL      0x0e		//Returns the signal strength 
 #define I_DIST        0x0f		//Returns the measured distance [cm] (Note this is a 16bit value => read two registers!)
+#define I_LOOP_COUNT  0x11		//Number of measurements after one acquisition command (0xff => free-running) 
+#define I_REF_COUNT   0x12		//Number of reference acquisitions 
+#define I_SERIAL      0x16		//Serial number of the sensor (two bytes) 
+#define I_SERIAL_CHK  0x18		//Serial number must be written here (two bytes) before the address can be changed 
+#define I_NEW_ADDR    0x1a		//New I2C address 
+#define I_THRESHOLD   0x1c		//Peak detection threshold bypass (0x00 => default detection algorithm) 
+#define I_ADDR_CONFIG 0x1e		//Selects the addresses the sensor responds to 
+#define I_MEAS_DELAY  0x45		//Delay between two automatic measurements (0x14 => 100Hz) 
+
+//COMMANDS AND FLAGS 
+#define CMD_RESET     0x00		//Written to the command register: reset to default settings 
+#define CMD_ACQUIRE   0x04		//Written to the command register: start a distance measurement 
+#define STATUS_BUSY   0x01		//Bit in the status register: the sensor is busy with a measurement 
+#define ACQ_USE_DELAY 0x20		//Bit in the acquisition mode control register: use the delay register for free-running measurements 
+#define LOOP_SINGLE   0x01		//Loop count for a single measurement per acquisition command 
+#define LOOP_INFINITE 0xff		//Loop count for an infinite number of measurements 
+#define ADDR_NEW_ONLY 0x08		//Written to the address config register: respond to the new address only 
 
 
 //EXTERNAL REGISTERS (read or write only) 
@@ -62,15 +120,51 @@ static struct {
 
 
 
+/************************************************************************/
+/* A C Q U I S I T I O N    P R O F I L E S                             */
+/************************************************************************/
+
+//Register values of an acquisition profile 
+typedef struct {
+	uint8_t sig_count;			//Maximum acquisition count 
+	uint8_t acq_config;			//Acquisition mode control (bit3 cleared => quick termination) 
+	uint8_t ref_count;			//Number of reference acquisitions 
+	uint8_t threshold;			//Threshold bypass (0x00 == detection threshold derived from the noise floor) 
+} profile_regs; 
+
+//Note: The order must match lidar_profile (stored in the flash, read with pgm_read_byte) 
+static const profile_regs profiles[] PROGMEM = {
+	{0x80, 0x08, 0x05, 0x00},	//LIDAR_PROFILE_DEFAULT 
+	{0x1d, 0x00, 0x03, 0x00},	//LIDAR_PROFILE_SHORT_FAST: few acquisitions with quick termination 
+	{0xff, 0x08, 0x05, 0x80}	//LIDAR_PROFILE_LONG_SENSITIVE: maximum number of acquisitions and the fixed, low detection 
+								//threshold of the vendor's "high sensitivity" configuration (weak returns are detected, 
+								//at the cost of more erroneous measurements) 
+};
+
+
+
 /************************************************************************/
 /* F U N C T I O N    P R O T O T Y P E S                               */
 /************************************************************************/
 
 /* @brief Write data to a register using I2C */ 
-bool write_register(uint8_t reg, uint8_t data); 
+bool write_register(uint8_t address, uint8_t reg, uint8_t data); 
 
 /* @brief Read data from a register using I2C */
-bool read_register(uint8_t reg, uint8_t numofbytes, uint8_t arraytosafe[2]); 
+bool read_register(uint8_t address, uint8_t reg, uint8_t numofbytes, uint8_t *arraytosafe); 
+
+/* @brief Give a sensor a new I2C address */ 
+bool assign_address(uint8_t id, uint8_t address); 
+
+/* @brief Return the pin of PORTD enabling a sensor */ 
+uint8_t enable_pin(uint8_t id); 
+
+/* @brief Queue the transaction of the non-blocking measurement */ 
+bool submit(lidar_device *dev, uint8_t txlen, uint8_t rxlen); 
+
+/* @brief Convert the bytes of a burst read and store the measurement */ 
+uint16_t store_sample(lidar_device *dev, uint8_t burst[BURST_LENGTH]); 
+
 
 
 
@@ -85,7 +179,9 @@ bool read_register(uint8_t reg, uint8_t numofbytes, uint8_t arraytosafe[2]);
 /************************************************************************/
 
 /**
- * Init the LIDAR Sensor 
+ * Init the LIDAR Sensors 
+ * With more than one sensor, the sensors are powered on one after the other and every sensor 
+ * gets its own address (FIRST_ADDR, FIRST_ADDR+2, ...). A single sensor keeps the default address. 
  *
  * @return true, iff initialization was successful 
  */
@@ -101,9 +197,35 @@ bool lidar_init(void) {
 		return false; 
 	}
 	
+	for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+		devices[id].address = SLAVE_ADDR; 
+		devices[id].last = (lidar_sample){0, 0, 0, 0}; 
+		devices[id].status = LIDAR_IDLE; 
+		devices[id].profile = LIDAR_PROFILE_DEFAULT; 
+		devices[id].streaming = false; 
+	}
 	
-	//Reset the lidar to defaults for Distance Measurements 
-	status = status && write_register(I_COMMAND_REG, 0x00); 
+	#if LIDAR_COUNT > 1
+	
+		//Power off all sensors => none of them responds to the default address 
+		for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+			PORTD &= ~(1<<enable_pin(id)); 
+			DDRD |= (1<<enable_pin(id)); 
+		}
+		
+		_delay_ms(BOOT_TIME); 
+		
+		//Power on one sensor after the other and move it away from the default address 
+		for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+			status = status && assign_address(id, FIRST_ADDR + 2*id); 
+		}
+	
+	#else
+	
+		//Reset the lidar to defaults for Distance Measurements 
+		status = status && write_register(SLAVE_ADDR, I_COMMAND_REG, CMD_RESET); 
+	
+	#endif
 	
 	//Return the status after all initialization is done
 	return status; 
@@ -113,196 +235,550 @@ bool lidar_init(void) {
 
 /**
  * Read the distance from the LIDAR Sensor 
+ * Note: This function blocks until the measurement is finished, see lidar_trigger() for the non-blocking version. 
+ *       The duration is bounded by the timeout of the acquisition. 
  *
- * @return the measured distance [cm] (Note: 16bit value!) 
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return the measured distance [cm] (Note: 16bit value!), zero if the measurement failed 
  */ 
-uint16_t lidar_measure(void) {
-	uint8_t result[2]; 
+uint16_t lidar_measure(uint8_t id) {
 	
-	if(!write_register(0x00,0x04)) {
-		//serial_send_string("error measure"); 
+	if(!lidar_trigger(id)) {
 		return 0; 
 	}
 	
-	//This delay is needed accoring to the LIDAR I2C Protocol. The Module will respond with a NACK, if a read or 
-	//write request is sent using I2C. 
-	//Maybe it is possible to do something else in this time...
-	//But be careful. Moving the Servo in this time can lead to a wrong measurement! 
-	_delay_ms(20); //Note: This delay is very important! (as soon as it is removed, the software crashes at some point!) 
+	lidar_status status; 
 	
-	//Read the Distance from the Register using I2C
-	if(!read_register(0x0f,2,result)) {
-		//The reading of the registers was NOT successful 
-		//Nothing we can do about this... might flag unhappy...
-		
-		return 0; 
-	}
+	//Wait until the sensor is ready 
+	do {
+		I2C_handler(); 
+		status = lidar_poll(id); 
+	} while(status != LIDAR_READY && status != LIDAR_ERROR); 
+	
+	return lidar_result(id); 
+}
+
+
 
+/**
+ * Start a new measurement. The function returns immediately, the state of the measurement 
+ * is checked using lidar_poll(). 
+ *
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return true, if the measurement was started 
+ */
+bool lidar_trigger(uint8_t id) {
 	
-	//Since we read a new distance from the Sensor, we can store it as the local state 
-	state.last_distance = ((result[0] << 8) | result[1]);
- 
- 
-	//Check the result: s
-	//The LIDAR returns zero, if the measurement was NOT successful. This means that no object is detected inside the measurement range of the LIDAR.
-	//In such a case set the measured distance to the maximum range in order to not confuse the filtering process. 
-	if(state.last_distance == 0) {
-		//The LIDAR did not detect anything inside the measurement range => we assign the maximum range 
+	lidar_device *dev = &devices[id]; 
+	
+	if(dev->streaming || dev->status == LIDAR_ACQUIRING || dev->status == LIDAR_READING) {
+		//A measurement is already running 
 		
-		state.last_distance = LIDAR_MAX_DISTANCE; 
+		return false; 
 	}
 	
+	//Write the acquisition command to the command register 
+	dev->tx[0] = I_COMMAND_REG; 
+	dev->tx[1] = CMD_ACQUIRE; 
+	
+	if(!submit(dev, 2, 0)) {
+		//The I2C queue is full => nothing we can do about this, try again later 
+		
+		return false; 
+	}
 	
-	//serial_send_string("LIDAR OK!"); 
-	//Return the current distance 
-	return state.last_distance;  
+	dev->status = LIDAR_ACQUIRING; 
+	dev->triggered = timer_get_ms(); 
 	
+	return true; 
 }
 
 
 
 /**
- * Get the last known distance from the sensor 
+ * Check the state of the measurement. As soon as the busy-bit in the status register of the sensor 
+ * is cleared, the result is read. 
+ * Note: This function must be called regularly (e.g. in every program loop) to advance the measurement. 
  *
- * @return The latest known distance 
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return state of the measurement 
  */
-uint16_t lidar_get_distance(void) {
+lidar_status lidar_poll(uint8_t id) {
+	
+	lidar_device *dev = &devices[id]; 
+	
+	switch(dev->status) {
+		case LIDAR_ACQUIRING: {
+			//Wait for the sensor to finish the acquisition 
+			
+			if(dev->transaction.status == I2C_PENDING) {
+				//The last transaction is still running on the bus 
+				
+				break; 
+			}
+			
+			if(dev->tx[0] == I_COMMAND_REG && dev->transaction.status == I2C_ERROR) {
+				//The sensor did not accept the acquisition command 
+				
+				dev->status = LIDAR_ERROR; 
+				break; 
+			}
+			
+			if(dev->tx[0] == I_STATUS && dev->transaction.status == I2C_DONE && !(dev->rx[0] & STATUS_BUSY)) {
+				//The acquisition is finished => read the result in one burst (the status is already known) 
+				
+				dev->last.status = dev->rx[0]; 
+				dev->tx[0] = 0x80 | I_VELOCITY; 
+				
+				if(submit(dev, 1, BURST_LENGTH)) {
+					dev->status = LIDAR_READING; 
+				}
+				
+				break; 
+			}
+			
+			if((timer_get_ms() - dev->triggered) > ACQUISITION_TIMEOUT) {
+				//The sensor does not finish => give up 
+				
+				dev->status = LIDAR_ERROR; 
+				break; 
+			}
+			
+			//The sensor is still busy (or did not respond to the last request) => read the status again 
+			//Note: The sensor does not acknowledge its address while it is busy, therefore failed reads are expected 
+			uint32_t now = timer_get_us(); 
+			
+			if((now - dev->last_poll) >= POLL_INTERVAL) {
+				
+				dev->tx[0] = I_STATUS; 
+				
+				if(submit(dev, 1, 1)) {
+					dev->last_poll = now; 
+				}
+			}
+			
+			break; 
+		}
+		case LIDAR_READING: {
+			//Wait for the result to be read 
+			
+			if(dev->transaction.status == I2C_DONE) {
+				
+				store_sample(dev, dev->rx); 
+				dev->status = LIDAR_READY; 
+				
+			} else if(dev->transaction.status == I2C_ERROR) {
+				
+				dev->status = LIDAR_ERROR; 
+			}
+			
+			break; 
+		}
+		default: {
+			//Nothing to do in the other states 
+			
+			break; 
+		}
+	}
 	
-	return state.last_distance; 
+	return dev->status; 
 }
 
 
 
+/**
+ * Get the distance of the finished measurement. The LIDAR is ready for the next measurement afterwards. 
+ *
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return the measured distance [cm], zero if the measurement failed 
+ */
+uint16_t lidar_result(uint8_t id) {
+	
+	lidar_device *dev = &devices[id]; 
+	lidar_status status = dev->status; 
+	
+	if(status == LIDAR_ACQUIRING || status == LIDAR_READING) {
+		//The measurement is not finished yet 
+		
+		return 0; 
+	}
+	
+	dev->status = LIDAR_IDLE; 
+	
+	if(status == LIDAR_READY) {
+		return dev->last.distance; 
+	} 
+	
+	return 0; 
+}
 
 
-/************************************************************************/
-/* P R I V A T E     F U N C T I O N S                                  */
-/************************************************************************/
 
-/** 
- * Write a value to a register 
+/**
+ * Start free-running measurements. The sensor repeats the measurements by itself at the given rate 
+ * (using the current acquisition profile), no command has to be sent per measurement. 
+ * The results are harvested using lidar_stream_poll(). 
  *
- * @param reg: Name of the register 
- * @param data: Data to be written to the register  
- */ 
-bool write_register(uint8_t reg, uint8_t data) {
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @param rate: Number of measurements per second [Hz] (8..1000) 
+ * @return true, if the free-running mode was started 
+ */
+bool lidar_stream_start(uint8_t id, uint16_t rate) {
 	
-	//serial_send_string("WRITE..."); 
+	lidar_device *dev = &devices[id]; 
 	
-	//Start the I2C Master interface. 
-	//We want to write a register => access-type is WRITE 
-	if(!I2C_start (SLAVE_ADDR, WRITE)) {
-		//I2C could not be started => nothing we can do against this, might flag unhappy...
-		//Anyway, stop the I2C Master interface
-		
-		//serial_send_string("can not write"); 
-		I2C_stop();
+	if(dev->streaming || dev->status == LIDAR_ACQUIRING || dev->status == LIDAR_READING || I2C_is_busy()) {
+		//A measurement is running => the sensor can not be configured now 
 		
 		return false; 
-	} else {
-		//I2C Master Interface is started => we can transfer the bytes to the slave 
-		
-		//Send Register address 
-		I2C_write_byte(reg); 
-		
-		//Send Value the register should contain 
-		I2C_write_byte(data);
-		
-		//Close the Master-Interface 
-		I2C_stop(); 
 	}
 	
-	//serial_send_string("Write OK");
-	//_delay_ms(3);  
+	//The delay register is 8bit => the rate is limited 
+	if(rate < STREAM_DELAY_RATE/0xFF + 1 || rate > STREAM_DELAY_RATE/2) {
+		return false; 
+	}
 	
-	//Everything is OK => return true
-	return true; 
+	bool status = true; 
+	
+	//Set the delay between two measurements and enable it in the acquisition mode 
+	status = status && write_register(dev->address, I_MEAS_DELAY, (uint8_t)(STREAM_DELAY_RATE/rate)); 
+	status = status && write_register(dev->address, I_ACQ_CONFIG, pgm_read_byte(&profiles[dev->profile].acq_config) | ACQ_USE_DELAY); 
+	
+	//Repeat the measurements infinitely and start them 
+	status = status && write_register(dev->address, I_LOOP_COUNT, LOOP_INFINITE); 
+	status = status && write_register(dev->address, I_COMMAND_REG, CMD_ACQUIRE); 
+	
+	if(status) {
+		dev->streaming = true; 
+		dev->busy_seen = false; 
+		dev->last_poll = timer_get_us(); 
+		dev->transaction.status = I2C_IDLE; 
+	}
+	
+	return status; 
 }
 
 
+
 /**
- * Read a value from a register 
+ * Stop the free-running measurements. The sensor does a single measurement per acquisition command again. 
  *
- * @param reg: Name of the register 
- * @param numofbytes: number of Bytes to be read (1,2) 
- * @param arraytosafe: Array with two bytes, where the result is stored 
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return true, if the sensor was reconfigured 
  */
-bool read_register(uint8_t reg, uint8_t numofbytes, uint8_t arraytosafe[2]) {
+bool lidar_stream_stop(uint8_t id) {
 	
-	//serial_send_string("READ..."); 
+	lidar_device *dev = &devices[id]; 
 	
-	//Start the I2C Master interface
-	//We want tor write a register first => access-type is WRITE 
-	if(!I2C_start(SLAVE_ADDR, WRITE)) {
-		//I2C could not be started => nothing we can do against this, might flag unhappy...
-		//Anyway, stop the I2C Master interface
-				
-		I2C_stop();
-		
-		//serial_send_string("I2C Error");
+	if(!dev->streaming) {
+		return true; 
+	}
+	
+	//Wait for a running read to finish 
+	if(dev->transaction.status == I2C_PENDING) {
+		I2C_wait(&dev->transaction); 
+	}
+	
+	dev->streaming = false; 
+	
+	//Note: The sensor is not reset, this would also reset its address 
+	bool status = true; 
+	
+	status = status && write_register(dev->address, I_LOOP_COUNT, LOOP_SINGLE); 
+	status = status && write_register(dev->address, I_ACQ_CONFIG, pgm_read_byte(&profiles[dev->profile].acq_config)); 
+	
+	return status; 
+}
+
+
+
+/**
+ * Harvest the results of the free-running measurements. The status register is read every POLL_INTERVAL, 
+ * the result is only read, if the sensor was busy since the last result (a new measurement finished). 
+ * The distance registers keep the last result => reading them without a new measurement would return it twice. 
+ * Note: This function must be called regularly (e.g. in every program loop). The sensor does not acknowledge 
+ *       its address while it is busy, a failed read of the status register is therefore handled like "busy". 
+ *
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @param time: Pointer where the estimated middle of the acquisition is stored [us] (see timer_get_us()) 
+ * @return true, if a new measurement was stored (see lidar_get_sample()) 
+ */
+bool lidar_stream_poll(uint8_t id, uint32_t *time) {
+	
+	lidar_device *dev = &devices[id]; 
+	
+	if(!dev->streaming || dev->transaction.status == I2C_PENDING) {
+		//No free-running measurements or a register is just being read 
 		
 		return false; 
-	} else {
-		//I2C Master Interface is started => we can transfer the bytes to the slave
-		//serial_send_string("send Bytes"); 
-		
-		//If two consecutive registers should be read, the address must contain a 1 as bit7
-		if(numofbytes == 2) {
-			//We want to write two consecutive registers => we must set bit7 of the register address to 1
-			reg = 0x80 | reg; 
-		}
-		
-		//Send the register address to be read
-		I2C_write_byte(reg); 
-		
-		//Stop the Interface 
-		I2C_stop();
+	}
+	
+	bool ret = false; 
+	
+	if(dev->transaction.status != I2C_IDLE) {
+		//A read is finished 
 		
-		//Start the I2C Master interface
-		//This time we want tor read a register => access-type is READ
-		if(!I2C_start(SLAVE_ADDR, READ)) {
-			//I2C could not be started => nothing we can do against this, might flag unhappy... 
-			//Anyway, stop the I2C Master interface 
+		if(dev->tx[0] == (0x80 | I_VELOCITY)) {
+			//The result of a new measurement was read 
 			
-			I2C_stop(); 
+			if(dev->transaction.status == I2C_DONE) {
+				store_sample(dev, dev->rx); 
+				*time = dev->acquired; 
+				ret = true; 
+			}
 			
-			//serial_send_string("Error: no read");
+		} else if(dev->transaction.status == I2C_ERROR || (dev->rx[0] & STATUS_BUSY)) {
+			//The sensor is measuring 
 			
-			return false; 
-		} else {
-			//I2C Master Interface is started => we can read the bytes from the slave 
+			if(!dev->busy_seen) {
+				dev->busy_seen = true; 
+				dev->busy_since = dev->last_poll; 
+			}
 			
-			//serial_send_string(" try to read"); 
+		} else if(dev->busy_seen) {
+			//The sensor was busy and is idle now => a new result is ready, read it in one burst 
 			
-			//Read one or two bytes from the Slave 
-			if(numofbytes == 1) {
-				//Only one byte is to be read 
-				
-				arraytosafe[0] = I2C_read_byte(); //The first byte is the last byte
-			} else if(numofbytes == 2) {
-				//Two bytes are to be read 
-				
-				arraytosafe[0] = I2C_read_byte();		//Read first byte 
-				//serial_send_string(" read first byte"); 
-				arraytosafe[1] = I2C_read_byte();		//Read second byte <=> last byte 
-				//serial_send_string(" read second byte");  
-				
-				//Stop the Master Interface for Reading 
-				//I2C_stop(); 
-			} else {
-				I2C_stop(); 
-				
+			dev->busy_seen = false; 
+			dev->acquired = dev->busy_since + (dev->last_poll - dev->busy_since)/2; 
+			dev->last.status = dev->rx[0]; 
+			dev->tx[0] = 0x80 | I_VELOCITY; 
+			
+			if(submit(dev, 1, BURST_LENGTH)) {
 				return false; 
 			}
 			
-			//Stop the Master-interface for Writing 
-			I2C_stop(); 
-		} //END OF I2C_READ
+			//The I2C queue is full => try again after the next read of the status register 
+			dev->busy_seen = true; 
+		}
 		
-	} //END OF I2C_WRITE
+		dev->transaction.status = I2C_IDLE; 
+	}
 	
-	//serial_send_string("EOF read"); 
+	//Read the status register regularly 
+	uint32_t now = timer_get_us(); 
 	
-	//Everything is OK => return true
-	return true; 
+	if((now - dev->last_poll) >= POLL_INTERVAL) {
+		
+		dev->tx[0] = I_STATUS; 
+		
+		if(submit(dev, 1, 1)) {
+			dev->last_poll = now; 
+		}
+	}
+	
+	return ret; 
+}
+
+
+
+/**
+ * Select the acquisition profile. The registers of the sensor are only written, if the profile changes. 
+ * Note: The profile can not be changed while a measurement is running 
+ *
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @param profile: Acquisition profile for the next measurements 
+ * @return true, if the profile is active 
+ */
+bool lidar_set_profile(uint8_t id, lidar_profile profile) {
+	
+	lidar_device *dev = &devices[id]; 
+	
+	if(profile == dev->profile) {
+		//Nothing to do 
+		
+		return true; 
+	}
+	
+	if(dev->streaming || dev->status == LIDAR_ACQUIRING || dev->status == LIDAR_READING || I2C_is_busy()) {
+		//A measurement is running => the sensor can not be configured now 
+		
+		return false; 
+	}
+	
+	const profile_regs *regs = &profiles[profile]; 
+	bool status = true; 
+	
+	status = status && write_register(dev->address, I_SIG_COUNT, pgm_read_byte(&regs->sig_count)); 
+	status = status && write_register(dev->address, I_ACQ_CONFIG, pgm_read_byte(&regs->acq_config)); 
+	status = status && write_register(dev->address, I_REF_COUNT, pgm_read_byte(&regs->ref_count)); 
+	status = status && write_register(dev->address, I_THRESHOLD, pgm_read_byte(&regs->threshold)); 
+	
+	if(status) {
+		dev->profile = profile; 
+	}
+	
+	return status; 
+}
+
+
+
+/**
+ * Get the last known distance from the sensor 
+ *
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return The latest known distance 
+ */
+uint16_t lidar_get_distance(uint8_t id) {
+	
+	return devices[id].last.distance; 
+}
+
+
+
+/**
+ * Get the last known measurement with signal strength, velocity and status 
+ *
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return The latest known measurement 
+ */
+lidar_sample lidar_get_sample(uint8_t id) {
+	
+	return devices[id].last; 
+}
+
+
+
+
+
+/************************************************************************/
+/* P R I V A T E     F U N C T I O N S                                  */
+/************************************************************************/
+
+/** 
+ * Write a value to a register 
+ *
+ * @param address: I2C address of the sensor 
+ * @param reg: Name of the register 
+ * @param data: Data to be written to the register  
+ */ 
+bool write_register(uint8_t address, uint8_t reg, uint8_t data) {
+	
+	//The register address is followed by the value the register should contain 
+	uint8_t bytes[2] = {reg, data}; 
+	
+	return I2C_transfer(address, bytes, 2, NULL, 0); 
+}
+
+
+/**
+ * Read a value from a register 
+ * The register address is written and the bytes are read in one transfer (repeated START). 
+ *
+ * @param address: I2C address of the sensor 
+ * @param reg: Name of the register 
+ * @param numofbytes: number of consecutive registers to be read 
+ * @param arraytosafe: Array with numofbytes bytes, where the result is stored 
+ */
+bool read_register(uint8_t address, uint8_t reg, uint8_t numofbytes, uint8_t *arraytosafe) {
+	
+	if(numofbytes == 0) {
+		return false; 
+	}
+	
+	//If consecutive registers should be read, the address must contain a 1 as bit7
+	if(numofbytes > 1) {
+		reg = 0x80 | reg; 
+	}
+	
+	return I2C_transfer(address, &reg, 1, arraytosafe, numofbytes); 
+}
+
+
+#if LIDAR_COUNT > 1
+/**
+ * Power on a sensor and give it a new I2C address. The sensor does not respond to the default address anymore. 
+ * Note: All sensors that are not yet moved to their new address must be powered off! 
+ * 
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @param address: new 7bit I2C address 
+ * @return true, if the sensor responds to the new address 
+ */
+bool assign_address(uint8_t id, uint8_t address) {
+	
+	bool status = true; 
+	uint8_t serial[2]; 
+	
+	//Power on the sensor => it responds to the default address 
+	PORTD |= (1<<enable_pin(id)); 
+	_delay_ms(BOOT_TIME); 
+	
+	//Reset the lidar to defaults for Distance Measurements 
+	status = status && write_register(SLAVE_ADDR, I_COMMAND_REG, CMD_RESET); 
+	_delay_ms(BOOT_TIME); 
+	
+	//The sensor accepts a new address only after its serial number was written back 
+	status = status && read_register(SLAVE_ADDR, I_SERIAL, 2, serial); 
+	status = status && write_register(SLAVE_ADDR, I_SERIAL_CHK, serial[0]); 
+	status = status && write_register(SLAVE_ADDR, I_SERIAL_CHK + 1, serial[1]); 
+	
+	//Set the new address and enable it, then disable the default address (using the new address) 
+	status = status && write_register(SLAVE_ADDR, I_NEW_ADDR, address); 
+	status = status && write_register(SLAVE_ADDR, I_ADDR_CONFIG, 0x00); 
+	status = status && write_register(address, I_ADDR_CONFIG, ADDR_NEW_ONLY); 
+	
+	if(status) {
+		devices[id].address = address; 
+	}
+	
+	return status; 
+}
+
+
+/**
+ * Return the pin of PORTD connected to the power enable pin of a sensor 
+ * 
+ * @param id: number of the sensor (0..LIDAR_COUNT-1) 
+ * @return the pin number 
+ */
+uint8_t enable_pin(uint8_t id) {
+	
+	return pgm_read_byte(&enable_pins[id]); 
+}
+#endif
+
+
+/**
+ * Queue the transaction of the non-blocking measurement. The bytes are taken from dev->tx and stored in dev->rx 
+ *
+ * @param dev: State of the sensor 
+ * @param txlen: Number of bytes to be written 
+ * @param rxlen: Number of bytes to be read 
+ * @return true, if the transaction was queued 
+ */
+bool submit(lidar_device *dev, uint8_t txlen, uint8_t rxlen) {
+	
+	dev->transaction.address = dev->address; 
+	dev->transaction.tx_data = dev->tx; 
+	dev->transaction.tx_length = txlen; 
+	dev->transaction.rx_data = dev->rx; 
+	dev->transaction.rx_length = rxlen; 
+	dev->transaction.callback = NULL; 
+	
+	return I2C_submit(&dev->transaction); 
+}
+
+
+/**
+ * Convert the bytes of a burst read (registers I_VELOCITY to I_DIST) and store the measurement as the local state 
+ *
+ * @param dev: State of the sensor 
+ * @param burst: Bytes read from the consecutive registers 
+ * @return the distance [cm] 
+ */
+uint16_t store_sample(lidar_device *dev, uint8_t burst[BURST_LENGTH]) {
+	
+	dev->last.velocity = (int8_t)burst[0]; 
+	dev->last.signal = burst[I_SIGNAL - I_VELOCITY]; 
+	dev->last.distance = ((burst[I_DIST - I_VELOCITY] << 8) | burst[I_DIST - I_VELOCITY + 1]);
+ 
+	//Check the result: 
+	//The LIDAR returns zero, if the measurement was NOT successful. This means that no object is detected inside the measurement range of the LIDAR.
+	//In such a case set the measured distance to the maximum range in order to not confuse the filtering process. 
+	if(dev->last.distance == 0) {
+		//The LIDAR did not detect anything inside the measurement range => we assign the maximum range 
+		
+		dev->last.distance = LIDAR_MAX_DISTANCE; 
+	}
+	
+	return dev->last.distance; 
 }
\ No newline at end of file
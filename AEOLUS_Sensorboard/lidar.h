@@ -12,14 +12,66 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-/* @brief Init the use of the lidar-sensor */ 
+
+/** State of a LIDAR measurement */
+typedef enum {
+	LIDAR_IDLE,			//No measurement is running 
+	LIDAR_ACQUIRING,	//The measurement was triggered and the sensor is busy 
+	LIDAR_READING,		//The acquisition is finished, the distance is read from the sensor 
+	LIDAR_READY,		//The distance can be taken using lidar_result() 
+	LIDAR_ERROR			//The measurement failed 
+} lidar_status;
+
+
+/** Result of a measurement, read in one burst from the LIDAR */
+typedef struct {
+	uint16_t distance;		//Measured distance [cm] (LIDAR_MAX_DISTANCE, if nothing was detected) 
+	uint8_t signal;			//Strength of the received signal (weak returns are unreliable) 
+	int8_t velocity;		//Change of the distance between two measurements [cm] 
+	uint8_t status;			//Status register of the LIDAR 
+} lidar_sample;
+
+
+/** Acquisition profiles of the LIDAR */
+typedef enum {
+	LIDAR_PROFILE_DEFAULT,			//Reset defaults of the sensor 
+	LIDAR_PROFILE_SHORT_FAST,		//Short range, fast shallow acquisitions 
+	LIDAR_PROFILE_LONG_SENSITIVE	//Maximum range, slow sensitive acquisitions 
+} lidar_profile;
+
+
+/* @brief Init the use of the lidar-sensors (every sensor is addressed by its number 0..LIDAR_COUNT-1) */ 
 bool lidar_init(void);
 
-/* @brief Do a new measurement with the LIDAR sensor */ 
-uint16_t lidar_measure(void); 
+/* @brief Do a new measurement with the LIDAR sensor (blocking) */ 
+uint16_t lidar_measure(uint8_t id); 
+
+/* @brief Start a new measurement (non-blocking) */ 
+bool lidar_trigger(uint8_t id); 
+
+/* @brief Check the state of the measurement started with lidar_trigger() */ 
+lidar_status lidar_poll(uint8_t id); 
+
+/* @brief Get the distance of the finished measurement */ 
+uint16_t lidar_result(uint8_t id); 
+
+/* @brief Select the acquisition profile for the next measurements */ 
+bool lidar_set_profile(uint8_t id, lidar_profile profile); 
+
+/* @brief Start free-running measurements at a given rate */ 
+bool lidar_stream_start(uint8_t id, uint16_t rate); 
+
+/* @brief Stop the free-running measurements */ 
+bool lidar_stream_stop(uint8_t id); 
+
+/* @brief Harvest a new result of the free-running measurements (non-blocking) */ 
+bool lidar_stream_poll(uint8_t id, uint32_t *time); 
 
 /* @brief Get the latest known distance measurement from the lidar-sensor */ 
-uint16_t lidar_get_distance(void);
+uint16_t lidar_get_distance(uint8_t id);
+
+/* @brief Get the latest known measurement (distance, signal strength, velocity and status) */ 
+lidar_sample lidar_get_sample(uint8_t id); 
 
 
 #endif /* LIDAR_H_ */
\ No newline at end of file
@@ -23,6 +23,8 @@
 
 #include "config.h"
 #include "port.h"
+#include "timer.h"
+#include "I2C.h"
 #include "servo.h"
 #include "lidar.h"
 #include "serial.h"
@@ -46,21 +48,25 @@ int main(void) {
 	//Init the input/output ports 
 	boot_state = boot_state && port_init(); 
 	
+	//Init the system time (used for timeouts) 
+	boot_state = boot_state && timer_init(); 
+	
 	//Init the use of a Servo
 	boot_state = boot_state && servo_init(); 
 	
+	//Allow for Interrupts (e.g. for serial communication and I2C) 
+	//Note: The I2C transactions are executed by the TWI-Interrupt => must be enabled before the LIDAR is initialized 
+	sei(); 
+	
 	//Init the use of the LIDAR 
-	//boot_state = boot_state && lidar_init();     //DEBUG: Remove true, this is only, because no lidar is present by now 
+	boot_state = boot_state && lidar_init(); 
 	
-	//Init the use of the Pixhawk 
-	//boot_state = boot_state && pixhawk_init();					//DEBUG: add this init ot the bool boot_state
+	//Init the use of the Pixhawk (also initializes the serial interface) 
+	boot_state = boot_state && pixhawk_init(); 
 	
 	//Init the measurement 
 	boot_state = boot_state && measure_init(); 
 	
-	//Allow for Interrupts (e.g. for serial communication) 
-	//sei(); 
-	
 	
 	
 	//Write a message to the serial interface, that the boot-process was successful
@@ -79,10 +85,14 @@ int main(void) {
 		
 		
 			//***SEND DATA TO PIXHAWK 
-			//The Pixhawk requests for data by sending commands. These commands are processed in the 
-			//Interrupt routine of the UART. 
-			//The answer to a request is sent when we have time in the pixhawk_handler(). 
-			//pixhawk_handler(); 
+			//The Pixhawk requests for data by sending commands. The interrupt routine of the UART only 
+			//stores the received bytes, the commands are decoded and answered in the pixhawk_handler(). 
+			pixhawk_handler(); 
+		
+		
+			//***I2C TIMEOUTS 
+			//Transactions that take too long are aborted and the bus is recovered 
+			I2C_handler(); 
 		
 		
 			//***MEASUREMENTS WITH THE LIDAR  
@@ -125,7 +135,7 @@ int main(void) {
 		
 		
 			//DISPLAY THE LIDAR DISTANCE IN SERIAL INTERFACE
-			//uint16_t dist = lidar_get_distance();
+			//uint16_t dist = lidar_get_distance(0);
 		
 			//char buffer[10]; 
 			//sprintf(buffer,"Dist: %d",dist);
@@ -9,35 +9,76 @@
 
 #include "config.h"
 #include <avr/delay.h>
+#include <avr/pgmspace.h>
 
 #include "lidar.h"
+#include "I2C.h"
 #include "servo.h"
+#include "timer.h"
 #include "serial.h"
-#include "buffer.h"
+#include "obstacles.h"
 #include "pixhawk.h"
+#include "measure.h"
 
 
 //static uint8_t obst_prob[(uint8_t)(RANGE*2/INTERVAL)]; 
-static uint8_t dist_mat[(uint16_t)(360/INTERVAL)];
-//static uint16_t head_mat[(uint16_t)(360/INTERVAL)]; 
+static uint8_t dist_mat[(uint16_t)(DEG(360)/INTERVAL)];
+//static uint16_t head_mat[(uint16_t)(DEG(360)/INTERVAL)]; 
 static uint16_t last_center; 
 
 //Small Version of the Distance Matrix, only the Measurements currently done are stored 
-static uint16_t dist_mat_small[2*RANGE/INTERVAL]; 
+static uint16_t dist_mat_small[DEG(2*RANGE)/INTERVAL]; 
+#if STORE_SIGNAL == 1
+static uint8_t sig_mat_small[DEG(2*RANGE)/INTERVAL];		//Signal strength of the measurements in the small Matrix 
+#endif
 static uint16_t head_valid; 
 
+//Mounting angle of the LIDAR sensors [] (stored in the flash) 
+static const uint16_t lidar_offsets[] PROGMEM = LIDAR_OFFSETS; 
+
+//Calibration of the servo 
+#define CAL_WINDOW 1000		//Time the readings are observed after each step [ms] 
+#define CAL_REPEAT 2		//Number of times each step is done in both directions 
+#define CAL_TOLERANCE 5		//Readings that differ less are considered equal (noise of the LIDAR) [cm] 
+
+//Step sizes of the calibration [] (the smallest one is the INTERVAL rounded up to full degrees, stored in the flash) 
+static const uint8_t cal_steps[] PROGMEM = {(INTERVAL + ANGLE_RES - 1)/ANGLE_RES, 10, 30, 90}; 
+
+//Stages of the calibration 
+typedef enum {CAL_REST, CAL_MOVE} cal_enum; 
+
+//Stages of the pipelined measurement 
+typedef enum {SETTLE, ACQUIRE, READ, FLUSH} stage_enum; 
+
+//Sectors of the small Matrix 
+#define SECTOR_SIZE (SECTOR_WIDTH/INTERVAL)		//Number of measurements in a sector 
+#define NO_SECTOR 0xFF
+
+#if (SECTOR_WIDTH % INTERVAL) != 0
+	#error "SECTOR_WIDTH must be a multiple of INTERVAL"
+#endif
 
 static struct {
-	uint16_t angle;		//Current angle to be checked => starboard border is 0
+	uint16_t angle;		//Current angle to be checked [1/ANGLE_RES ] => starboard border is 0
 	int8_t direction;	//Increasing or Decreasing of the angle (starboard --> backboard = 1; backboard --> starboard = -1)
 	uint16_t last_center; //Center angle for which the data in the array is valid 
 	uint16_t curr_center; //Current center known from the Pixhawk 
 	
 	uint16_t max_tn_angle_ind;	//Maximum index that ocuured during the measurement process 
 	uint16_t min_tn_angle_ind;  //Minimum index that occured during the measurement process 
+	
+	stage_enum stage;			//Stage of the pipelined measurement 
+	uint16_t measured_angle;	//Angle of the measurement that is being read [1/ANGLE_RES ] 
+	uint8_t lidar;				//Sensor that is acquiring 
+	uint8_t measured_lidar;		//Sensor whose measurement is being read 
+	uint16_t triggered_angle;	//Measured position of the servo when the acquiring sensor was triggered [1/ANGLE_RES ] 
+	
+	uint8_t sector;				//Sector of the small Matrix the scan is in (NO_SECTOR after the init) 
 } state = {
 	.angle = 0, 
 	.direction = 1,
+	.stage = SETTLE,
+	.sector = NO_SECTOR,
 	
 	.max_tn_angle_ind = 0x0000,
 	.min_tn_angle_ind = 0xFFFF 
@@ -45,12 +86,25 @@ static struct {
 
 static struct {
 	int16_t threshold; //Threshold above which the correlated value is considered as an obstacle
+	uint8_t min_signal; //Minimum signal strength of a valid measurement 
 } config = {
-	.threshold = 10
+	.threshold = 10,
+	.min_signal = LIDAR_MIN_SIGNAL
 };
 
-CircularBuffer obst_buffer;	//Circular Buffer holding the detected obstacles 
-
+static struct {
+	bool running;		//true, while the calibration runs instead of the measurement 
+	cal_enum stage;		//Stage of the calibration (see calibrate()) 
+	uint8_t step;		//Index of the step size in cal_steps 
+	uint8_t repeat;		//Number of moves done with the step size 
+	bool moved;			//true, if any move of the step size changed the readings 
+	uint32_t start;		//Start of the stage [ms] 
+	uint32_t changed;	//Time of the last change of the readings [ms] 
+	uint16_t ref;		//Reference reading [cm] (0 == no valid reading yet) 
+	int32_t n, sum_x, sum_y, sum_xx, sum_xy;	//Sums of the least squares fit (x: step size [], y: settle time [ms]) 
+} cal = {
+	.running = false
+};
 
 
 /* @brief Filter the data and try to find outliers */ 
@@ -60,9 +114,48 @@ void filter();
 void push2matrix(uint16_t dist, uint16_t angle); 
 
 /* @brief Store a value in the small distance Matrix */ 
-void push2matrix_small(uint16_t dist); 
+void push2matrix_small(uint16_t dist, uint8_t signal, uint16_t angle); 
+
+/* @brief Advance the pipelined measurement of the MEASURE_STEP mode */ 
+void step(void); 
+
+/* @brief Harvest the free-running measurements of the MEASURE_SWEEP mode */ 
+void harvest(void); 
+
+/* @brief Store the last measurement of a sensor in the distance Matrices */ 
+void store(uint8_t lidar, uint16_t angle); 
+
+/* @brief Move the servo to the next angle of the scan */ 
+void next_angle(void); 
+
+/* @brief Angle a sensor is looking at */ 
+uint16_t bearing(uint8_t lidar, uint16_t angle); 
+
+/* @brief Start the measurement of a sensor and remember where it started */ 
+bool trigger(uint8_t lidar); 
+
+/* @brief Wait for running measurements to finish and forget about them */ 
+void stop(void); 
+
+/* @brief Advance the calibration of the servo */ 
+void calibrate(void); 
 
-/* @brief Take the modulo for 360 */
+/* @brief Start the next stage of the calibration */ 
+bool cal_next(uint32_t now); 
+
+/* @brief Move the servo to the start of a step size and let it come to rest */ 
+void cal_rest(uint32_t now); 
+
+/* @brief Fit the motion model to the settle times and store it */ 
+bool cal_fit(void); 
+
+/* @brief End the calibration and restart the measurement */ 
+void cal_finish(bool stored); 
+
+/* @brief Store an obstacle in the obstacle store */ 
+bool add_obstacle(uint16_t start_ind, uint16_t end_ind, uint16_t dist, int16_t jump); 
+
+/* @brief Take the modulo for 360 (in angle units) */
 uint16_t mod(int16_t); 
 
 
@@ -74,6 +167,16 @@ uint16_t mod(int16_t);
  */
 bool measure_init(void) {
 	
+	//Forget about running measurements 
+	stop(); 
+	
+	if(cal.running) {
+		//The calibration is aborted => the old motion model is kept 
+		
+		cal.running = false; 
+		pixhawk_push_calibration(false); 
+	}
+	
 	//Move the Servo to start-position 
 	servo_set(0); 
 	
@@ -83,11 +186,14 @@ bool measure_init(void) {
 	//Set the direction (Starboard to Backboard) 
 	state.direction = 1; 
 	
-	//Initialize the Buffer
-	//obst_buffer = buffer_init(MAX_OBSTACLE_NUMBER); 
+	//No sector was measured yet 
+	state.sector = NO_SECTOR; 
+	
+	//Remove all obstacles 
+	obstacles_init(); 
 	
 	//Init the Distance Matrix with Zero 
-	for(uint16_t i = 0; i<360/INTERVAL; i++) {
+	for(uint16_t i = 0; i<DEG(360)/INTERVAL; i++) {
 		dist_mat[i] = 0;
 	}
 	
@@ -96,10 +202,55 @@ bool measure_init(void) {
 	
 	
 	#if DEBUG_CHEAPSERVO
-		servo_set(90); 
-		state.angle = 90; 
+		servo_set(DEG(90)); 
+		state.angle = DEG(90); 
+	#endif
+	
+	#if MEASURE_MODE == MEASURE_SWEEP
+		//Sweep over the whole sector without stopping, the LIDARs measure at their own rate 
+		servo_sweep_start(0, DEG(2*RANGE), SWEEP_SPEED); 
+		
+		for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+			lidar_stream_start(id, SWEEP_RATE); 
+		}
 	#endif
 	
+	//Start with a measurement as soon as the servo is at the start-position 
+	//Note: stop() lets the acquisitions that are still running finish first (FLUSH) 
+	
+	
+	return true; 
+}
+
+
+
+/**
+ * Start the calibration of the motion model of the servo 
+ * The servo is moved by steps of different size. After each step the LIDAR measures as fast as possible, 
+ * the time of the last reading that differs from its predecessor is the settle time of the step. 
+ * A line (base + per_deg*step) is fitted through the settle times and stored in the EEPROM. 
+ * Note: The LIDAR must see a structured scene (readings change while the servo moves). The calibration runs in 
+ *       measure_handler() instead of the measurement (every step size takes (1 + 2*CAL_REPEAT)*CAL_WINDOW, 
+ *       about 20s in total), the measurement is restarted (measure_init()) afterwards. The function does not wait, 
+ *       the result is sent to the Pixhawk as soon as the calibration is finished (pixhawk_push_calibration()). 
+ *
+ * @return true, if the calibration was started 
+ */
+bool measure_calibrate(void) {
+	
+	stop(); 
+	
+	cal.n = 0; 
+	cal.sum_x = 0; 
+	cal.sum_y = 0; 
+	cal.sum_xx = 0; 
+	cal.sum_xy = 0; 
+	
+	//Go to the start of the first step and let the servo come to rest 
+	cal.step = 0; 
+	cal_rest(timer_get_ms()); 
+	
+	cal.running = true; 
 	
 	return true; 
 }
@@ -110,26 +261,244 @@ bool measure_init(void) {
  * Move the servo to start position. Then increment until the end is reached. 
  * In each step do a distance measurement. 
  *
+ * The steps are pipelined: As soon as the LIDAR finished the acquisition at angle N, the servo is commanded 
+ * to angle N+1. The distance for angle N is read over I2C and stored while the servo is already moving. 
+ *   SETTLE:  wait until the servo reached the angle (see servo_is_settled()), then trigger the first LIDAR 
+ *   ACQUIRE: wait until the acquisition is finished, then trigger the next LIDAR or move the servo to the next angle 
+ *   READ:    wait until the distance is read and store it, then wait for the next LIDAR 
+ *   FLUSH:   wait until the measurements that were running during stop() are finished and drop them 
+ * With more than one LIDAR, the sensors measure one after the other at the same servo angle. 
+ *
+ * In the MEASURE_SWEEP mode the servo does not stop and the LIDARs measure by themselves (free-running). 
+ * Every new result gets the angle of the servo at the middle of its acquisition (see servo_get_angle_at()). 
+ * With SERVO_FEEDBACK the measured position of the servo is used instead of the commanded angle. 
+ *
  * => This function should be called in every iteration step in the main-function or by a timer interrupt, dependent on the 
  *    scheduling strategy.  
+ *
+ * Note: The function never waits for the LIDAR or the servo. It returns immediately and the main loop is 
+ *       free for other tasks. 
  */
 void measure_handler(void) {
 	
-	/*
-	uint16_t dist = lidar_measure();
-	_delay_ms(500); 
-	*/
+	if(cal.running) {
+		//The calibration of the servo replaces the measurement until it is finished 
+		
+		calibrate(); 
+		return; 
+	}
+	
+	#if MEASURE_MODE == MEASURE_SWEEP
+		harvest(); 
+	#else
+		step(); 
+	#endif
+}
 
-	#if DEBUG_CHEAPSERVO == 1
+
+
+/**
+ * Advance the pipelined measurement of the MEASURE_STEP mode (see measure_handler()) 
+ */
+void step(void) {
 	
-		if(state.angle >= 2*RANGE) {
+	switch(state.stage) {
+		case SETTLE: {
+			//The servo is moving to state.angle 
+			
+			if(!servo_is_settled()) {
+				//The servo did not reach the angle yet 
+				
+				break; 
+			}
+			
+			//SELECT THE ACQUISITION PROFILES 
+			//Far range is only needed in front of the boat, the sides are measured fast 
+			for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+				uint16_t dir = bearing(id, state.angle); 
+				
+				if(dir >= DEG(RANGE-FORWARD_SECTOR) && dir <= DEG(RANGE+FORWARD_SECTOR)) {
+					lidar_set_profile(id, LIDAR_PROFILE_LONG_SENSITIVE); 
+				} else {
+					lidar_set_profile(id, LIDAR_PROFILE_SHORT_FAST); 
+				}
+			}
+			
+			//START THE MEASUREMENT  
+			//If the LIDAR can not be triggered now, we try again in the next call 
+			state.lidar = 0; 
+			
+			if(trigger(state.lidar)) {
+				state.stage = ACQUIRE; 
+			}
+			
+			break; 
+		}
+		case ACQUIRE: {
+			//The LIDAR state.lidar measures at state.angle 
+			
+			lidar_status status = lidar_poll(state.lidar); 
 			
-			_delay_ms(100);
+			if(status == LIDAR_IDLE) {
+				//The LIDAR could not be triggered yet => try again 
+				
+				trigger(state.lidar); 
+				break; 
+			}
+			
+			if(status == LIDAR_ACQUIRING) {
+				//The LIDAR is still busy => the servo must not move 
+				
+				break; 
+			}
+			
+			#if SERVO_FEEDBACK == 1
+			
+				//Take the mean of the measured positions at the start and the end of the acquisition 
+				state.measured_angle = (state.triggered_angle + servo_get_position())/2; 
+			
+			#else
+			
+				state.measured_angle = state.angle; 
+			
+			#endif
+			
+			state.measured_lidar = state.lidar; 
+			state.lidar++; 
+			
+			if(state.lidar < LIDAR_COUNT) {
+				//The next LIDAR measures at the same angle 
+				
+				trigger(state.lidar); 
+			} else {
+				//All acquisitions are finished => the servo can already move to the next angle 
+				
+				next_angle(); 
+			}
+			
+			if(status == LIDAR_ERROR) {
+				//The measurement failed => skip it 
+				
+				lidar_result(state.measured_lidar); 
+				state.stage = (state.lidar < LIDAR_COUNT) ? ACQUIRE : SETTLE; 
+			} else {
+				state.stage = READ; 
+			}
+			
+			break; 
+		}
+		case READ: {
+			//The distance is read while the servo is moving (or the next LIDAR is acquiring) 
+			
+			lidar_status status = lidar_poll(state.measured_lidar); 
+			
+			if(status == LIDAR_READING) {
+				break; 
+			}
+			
+			lidar_result(state.measured_lidar); 
+			
+			if(status == LIDAR_READY) {
+				//TELL THE VALUE TO THE FILTER-UNIT
+				//Note: failed measurements are skipped
+				
+				store(state.measured_lidar, state.measured_angle); 
+			}
+			
+			state.stage = (state.lidar < LIDAR_COUNT) ? ACQUIRE : SETTLE; 
+			
+			break; 
+		}
+		case FLUSH: {
+			//The measurement was stopped => drop the results of the measurements that were running 
+			
+			for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+				lidar_status status = lidar_poll(id); 
+				
+				if(status == LIDAR_ACQUIRING || status == LIDAR_READING) {
+					//Still busy => check again in the next call 
+					
+					return; 
+				}
+			}
+			
+			for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+				lidar_result(id); 
+			}
+			
+			state.stage = SETTLE; 
+			
+			break; 
+		}
+	}
+}
+
+
+
+/**
+ * Harvest the free-running measurements of the MEASURE_SWEEP mode. Every new result is stored at the 
+ * angle of the servo at the middle of its acquisition. 
+ */
+void harvest(void) {
+	
+	for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+		uint32_t time; 
+		
+		if(!lidar_stream_poll(id, &time)) {
+			//No new result 
+			
+			continue; 
+		}
+		
+		#if SERVO_FEEDBACK == 1
+			store(id, servo_get_position()); 
+		#else
+			store(id, servo_get_angle_at(time)); 
+		#endif
+	}
+}
+
+
+
+/**
+ * Store the last measurement of a sensor in the distance Matrices 
+ *
+ * @param lidar: number of the sensor 
+ * @param angle: servo angle of the measurement [1/ANGLE_RES ] 
+ */
+void store(uint8_t lidar, uint16_t angle) {
+	
+	lidar_sample sample = lidar_get_sample(lidar); 
+	uint16_t dir = bearing(lidar, angle); 
+	
+	if(sample.signal < config.min_signal) {
+		//The return is too weak to be trusted => handle it like "nothing detected" 
+		
+		sample.distance = LIDAR_MAX_DISTANCE; 
+	}
+	
+	push2matrix(sample.distance, dir); 
+	push2matrix_small(sample.distance, sample.signal, dir); 
+}
+
+
+
+/**
+ * Move the servo to the next angle of the scan. At the end of the sector the direction is changed 
+ * or the scan starts again. 
+ * Note: The servo is commanded only, the measurement waits for servo_is_settled() 
+ */
+void next_angle(void) {
+	
+	//Increase the Angle
+	state.angle += (state.direction * INTERVAL);
+
+	#if DEBUG_CHEAPSERVO == 1
+	
+		if(state.angle >= DEG(2*RANGE)) {
 			
 			state.direction = -1;
-			state.angle = 90;  
-			servo_set(state.angle); 
-			_delay_ms(180);   
+			state.angle = DEG(90);  
 			
 			//We set the Heading of the Boat 
 			//head_valid = pixhawk_get_heading(); 
@@ -137,26 +506,20 @@ void measure_handler(void) {
 		
 		if(state.angle <= 0) {
 			
-			_delay_ms(100);
-			
 			state.direction = 1; 
-			state.angle = 90;
-			servo_set(state.angle); 
-			_delay_ms(180); 
-  
+			state.angle = DEG(90);
 		}
 		
 	
 	#else 
 	
 		//Check if we already finished one round 
-		if(state.angle >= 2*RANGE) {
+		if(state.angle >= DEG(2*RANGE)) {
 			//We are at the end => on backbord-side 
 		 
 			//state.direction = -1;
 			state.direction = 1; 
 			state.angle = 0;
-			servo_set(0);  
 			port_led_blink(1);  
 		}
 	
@@ -170,51 +533,267 @@ void measure_handler(void) {
 	#endif
 	
 	//MOVE THE SERVO TO THE NEW ANGLE
+	//Note: The time the servo needs (also for the long way back) is given by its calibrated motion model 
 	servo_set(state.angle); 
+}
 
-	//DO THE MEASUREMENT  
-	//uint16_t dist = lidar_measure();
+
+/**
+ * Calculate the angle a sensor is looking at 
+ *
+ * @param lidar: number of the sensor 
+ * @param angle: servo angle [1/ANGLE_RES ] 
+ * @return servo angle plus the mounting angle of the sensor [1/ANGLE_RES ] (0..DEG(360)-1) 
+ */
+uint16_t bearing(uint8_t lidar, uint16_t angle) {
 	
-	//TELL THE VALUE TO THE FILTER-UNIT
-	//push2matrix(dist, state.angle); 
-	//push2matrix_small(dist); 
+	return (angle + DEG(pgm_read_word(&lidar_offsets[lidar]))) % DEG(360); 
+}
+
+
+/**
+ * Start the measurement of a sensor. With SERVO_FEEDBACK the position of the servo is stored to calculate 
+ * the angle of the measurement. 
+ *
+ * @param lidar: number of the sensor 
+ * @return true, if the measurement was started 
+ */
+bool trigger(uint8_t lidar) {
 	
-	//Increase the Angle
-	state.angle += (state.direction * INTERVAL);
+	if(!lidar_trigger(lidar)) {
+		return false; 
+	}
 	
+	#if SERVO_FEEDBACK == 1
+		state.triggered_angle = servo_get_position(); 
+	#endif
+	
+	return true; 
+}
+
+
+/**
+ * Forget about the running measurements of all sensors 
+ * Note: The function does not wait, the measurements are finished and dropped in the FLUSH stage of step() 
+ *       (the calibration takes a running measurement of the first sensor as its first reading) 
+ */
+void stop(void) {
+	
+	//Free-running measurements of the MEASURE_SWEEP mode 
+	for(uint8_t id = 0; id < LIDAR_COUNT; id++) {
+		lidar_stream_stop(id); 
+	}
+	
+	if(state.stage != SETTLE) {
+		//A measurement may be running 
+		
+		state.stage = FLUSH; 
+	}
+}
+
+
+/**
+ * Advance the calibration of the servo (see measure_calibrate()) 
+ * The first LIDAR measures one reading after the other. When the CAL_WINDOW of a stage is over, the next one starts: 
+ *   CAL_REST: the servo moves to the start of a step size and comes to rest, the last reading is the reference 
+ *   CAL_MOVE: the servo moves by the step size, the time of the last reading that differs from the reference 
+ *             (by more than CAL_TOLERANCE) is the settle time of the move 
+ */
+void calibrate(void) {
+	
+	lidar_status status = lidar_poll(0); 
+	
+	if(status == LIDAR_ACQUIRING || status == LIDAR_READING) {
+		//Wait for the reading 
+		
+		return; 
+	}
+	
+	uint32_t now = timer_get_ms(); 
+	uint16_t dist = lidar_result(0);	//zero, if the measurement failed (or none was started) 
+	
+	if(dist != 0) {
+		
+		if(cal.stage == CAL_REST || cal.ref == 0) {
+			//The servo comes to rest 
+			
+			cal.ref = dist; 
+		} else if(dist > cal.ref + CAL_TOLERANCE || dist + CAL_TOLERANCE < cal.ref) {
+			//The reading changed => the servo is still moving 
+			
+			cal.ref = dist; 
+			cal.changed = now; 
+		}
+	}
+	
+	if(now - cal.start >= CAL_WINDOW && !cal_next(now)) {
+		//The calibration is finished 
+		
+		return; 
+	}
+	
+	//Take the next reading (if the I2C queue is full, we try again in the next call) 
+	//Note: The profile is only written once, the sensor must not be acquiring 
+	lidar_set_profile(0, LIDAR_PROFILE_SHORT_FAST); 
+	lidar_trigger(0); 
+}
+
+
+/**
+ * Start the next stage of the calibration: move the servo forth and back CAL_REPEAT times per step size, 
+ * then go to the next step size. After the last one, the motion model is fitted. 
+ *
+ * @param now: current time [ms] 
+ * @return false, if the calibration is finished 
+ */
+bool cal_next(uint32_t now) {
+	
+	uint8_t step = pgm_read_byte(&cal_steps[cal.step]); 
+	uint16_t from = RANGE - step/2; 
+	
+	if(cal.stage == CAL_MOVE) {
+		//The settle time of the move is known 
+		
+		int16_t time = cal.changed - cal.start; 
+		
+		cal.moved = cal.moved || (time > 0); 
+		cal.repeat++; 
+		
+		cal.n++; 
+		cal.sum_x += step; 
+		cal.sum_y += time; 
+		cal.sum_xx += (int32_t)step*step; 
+		cal.sum_xy += (int32_t)step*time; 
+	} else if(cal.ref == 0) {
+		//No valid reading while the servo came to rest => the LIDAR does not work, give up 
+		
+		cal_finish(false); 
+		return false; 
+	}
+	
+	if(cal.repeat < 2*CAL_REPEAT) {
+		//Move forth and back 
+		
+		servo_set(DEG((cal.repeat % 2 == 0) ? from + step : from)); 
+		
+		cal.stage = CAL_MOVE; 
+		cal.start = now; 
+		cal.changed = now; 
+		
+		return true; 
+	}
+	
+	if(!cal.moved) {
+		//The readings did not change => the scene is not suitable, keep the old model 
+		
+		cal_finish(false); 
+		return false; 
+	}
+	
+	cal.step++; 
+	
+	if(cal.step < sizeof(cal_steps)) {
+		//Next step size 
+		
+		cal_rest(now); 
+		return true; 
+	}
+	
+	cal_finish(cal_fit()); 
+	return false; 
+}
+
+
+/**
+ * Move the servo to the start of the current step size and let it come to rest for CAL_WINDOW 
+ *
+ * @param now: current time [ms] 
+ */
+void cal_rest(uint32_t now) {
+	
+	uint8_t step = pgm_read_byte(&cal_steps[cal.step]); 
+	
+	servo_set(DEG(RANGE - step/2)); 
+	
+	cal.stage = CAL_REST; 
+	cal.start = now; 
+	cal.ref = 0; 
+	cal.repeat = 0; 
+	cal.moved = false; 
+}
+
+
+/**
+ * Fit a line (base + per_deg*step) through the settle times (least squares) and store it as motion model 
+ *
+ * @return true, if a new model was stored 
+ */
+bool cal_fit(void) {
+	
+	int32_t per_deg = SERVO_MODEL_SCALE*(cal.n*cal.sum_xy - cal.sum_x*cal.sum_y)/(cal.n*cal.sum_xx - cal.sum_x*cal.sum_x); 
+	int32_t base = (cal.sum_y - per_deg*cal.sum_x/SERVO_MODEL_SCALE)/cal.n; 
+	
+	if(per_deg <= 0) {
+		//Larger steps do not take longer => something went wrong 
+		
+		return false; 
+	}
+	
+	if(base < 0) {
+		base = 0; 
+	}
+	
+	servo_set_model(base, per_deg); 
+	
+	return true; 
+}
+
+
+/**
+ * End the calibration, send its result to the Pixhawk and restart the measurement 
+ *
+ * @param stored: true, if a new motion model was stored 
+ */
+void cal_finish(bool stored) {
+	
+	cal.running = false; 
+	pixhawk_push_calibration(stored); 
+	
+	measure_init(); 
 }
 
 
 /**
  * Push the value into the distance measurement matrix 
  * 
- * 
+ * @param dist: measured distance [cm] 
+ * @param angle: angle of the measurement (servo angle plus mounting angle of the sensor) [1/ANGLE_RES ] 
  */
-void push2matrix(uint16_t dist, uint16_t angle_tn) {
+void push2matrix(uint16_t dist, uint16_t angle) {
 	
 	//CALCULATE ANGLE WRT TRUE NORTH 
 	int16_t curr_course = pixhawk_get_heading(); 
-	curr_course = 20; 
-	//int16_t angle_tn = state.angle;
+	curr_course = DEG(20); 
+	uint16_t angle_tn = 0;
 	int16_t alpha = 0; 	
 
-	if(state.angle < RANGE) {
+	if(angle < DEG(RANGE)) {
 		//This is plus => to the starboard side of the boat
 	
-		alpha = RANGE - state.angle;
+		alpha = DEG(RANGE) - angle;
 	
 		angle_tn = mod(curr_course + alpha);
 	}
 	
-	if(state.angle > RANGE) {
+	if(angle > DEG(RANGE)) {
 		//This is minus => to the backboard side of the boat
 		
-		alpha = state.angle - RANGE;
+		alpha = angle - DEG(RANGE);
 			
 		angle_tn = mod(curr_course - alpha);
 	}
 
-	if(state.angle == RANGE) {
+	if(angle == DEG(RANGE)) {
 		//The obstacle lays direct in front of us
 	
 		angle_tn = curr_course;
@@ -223,7 +802,7 @@ void push2matrix(uint16_t dist, uint16_t angle_tn) {
 	
 	
 	//PUSH THE VALUE INTO THE DISTANCE MATRIX 
-	uint16_t index = (float)angle_tn/(float)INTERVAL;		//Index in Distance Matrix 
+	uint16_t index = angle_tn/INTERVAL;		//Index in Distance Matrix 
 	
 	dist_mat[index] = dist;					//Store value in Matrix		
 }
@@ -232,13 +811,39 @@ void push2matrix(uint16_t dist, uint16_t angle_tn) {
 /**
  * Store the measurement in a Matrix (small Matrix) 
  * 
+ * @param dist: measured distance [cm] 
+ * @param signal: signal strength of the measurement 
+ * @param angle: angle of the measurement (servo angle plus mounting angle of the sensor) [1/ANGLE_RES ] 
  */
-void push2matrix_small(uint16_t dist) {
+void push2matrix_small(uint16_t dist, uint8_t signal, uint16_t angle) {
 	
-	uint16_t ind = state.angle/INTERVAL; 
+	uint16_t ind = angle/INTERVAL; 
+	
+	if(ind >= DEG(2*RANGE)/INTERVAL) {
+		//The angle is outside of the sector of the servo (e.g. a sensor looking backwards) 
+		
+		return; 
+	}
 	
 	dist_mat_small[ind] = dist; 
+	#if STORE_SIGNAL == 1
+	sig_mat_small[ind] = signal; 
+	#endif
 	
+	//A sector is complete, as soon as the scan continues in an other one 
+	uint8_t sector = ind/SECTOR_SIZE; 
+	
+	if(sector != state.sector) {
+		
+		if(state.sector != NO_SECTOR) {
+			//Push the sector and the obstacles found so far (only sent, if the Pixhawk subscribed to them) 
+			
+			pixhawk_push_sector(state.sector*SECTOR_SIZE, SECTOR_SIZE); 
+			pixhawk_push_obstacles(); 
+		}
+		
+		state.sector = sector; 
+	}
 }	
 
 
@@ -252,6 +857,18 @@ uint16_t measure_get_distance_small(uint16_t ind) {
 	
 }
 
+#if STORE_SIGNAL == 1
+/**
+ * Get the signal strength of the measurements stored in the small Matrix 
+ *
+ */
+uint8_t measure_get_signal_small(uint16_t ind) {
+	
+	return sig_mat_small[ind]; 
+	
+}
+#endif
+
 /**
  * Get the heading for which the small distance matrix is valid 
  *
@@ -268,7 +885,7 @@ void filter(void) {
 	bool start = false;
 	uint16_t start_ind = 0;  
 	
-	for (uint16_t ind = 1; ind < (360/INTERVAL)-1; ind++) {
+	for (uint16_t ind = 1; ind < (DEG(360)/INTERVAL)-1; ind++) {
 		
 		//Differentiate 
 		int16_t diff = (int16_t)(dist_mat[ind-1] - dist_mat[ind]); 
@@ -290,7 +907,7 @@ void filter(void) {
 				
 				start = false;
 				
-				buffer_add(&obst_buffer,obst_index*INTERVAL,dist_mat[obst_index]);
+				add_obstacle(start_ind, ind, dist_mat[obst_index], -diff);
 			}
 			
 		}
@@ -322,7 +939,7 @@ void filter_correlate(void) {
 	//Correlate the measurement data with the template and rate obstacles 
 	//TODO change this in the way such that only measured headings are taken into account => state.min_index, state.max_index	
 	//Check what happens, at discontinuity 0->360
-	for(uint16_t ind=template_midInd; ind <= (360/INTERVAL)-(template_midInd+1); ind++) {
+	for(uint16_t ind=template_midInd; ind <= (DEG(360)/INTERVAL)-(template_midInd+1); ind++) {
 	
 		int16_t sum1 = 0;
 
@@ -338,7 +955,7 @@ void filter_correlate(void) {
 			//We found an obstacle => store it in the dynamic buffer 
 		
 			//Add data to the buffer 	
-			buffer_add(&obst_buffer,ind*INTERVAL,dist_mat[ind]);
+			add_obstacle(ind, ind, dist_mat[ind], sum1);
 			
 			//port_led_blink(1); 
 		}		
@@ -373,7 +990,7 @@ void filter_correlate(void) {
 	//Correlate the measurement data with the template and rate obstacles
 	//TODO change this in the way such that only measured headings are taken into account => state.min_index, state.max_index
 	//Check what happens, at discontinuity 0->360
-	for(uint16_t ind=template_midInd; ind <= (360/INTERVAL)-(template_midInd+1); ind++) {
+	for(uint16_t ind=template_midInd; ind <= (DEG(360)/INTERVAL)-(template_midInd+1); ind++) {
 		
 		int16_t sum1 = 0;
 		int16_t sum2 = 0; 
@@ -408,8 +1025,6 @@ void filter_correlate(void) {
 		if(start == true && sum2 > config.threshold && sum1 < config.threshold) {
 			//We found a possible end-sequence that follows after a start-sequence of an obstacle 
 			
-			uint16_t obst_index = (uint16_t)((ind-start_ind)/2) + start_ind; 
-			
 			start = false; 
 			
 			//char str[] = {"END "};
@@ -417,7 +1032,7 @@ void filter_correlate(void) {
 			
 			//Add the obstacle to the buffer 
 			//port_led_blink(1);	//DEBUG: Blink once for every detected obstacle 
-			buffer_add(&obst_buffer,obst_index*INTERVAL,dist_mat[ind]);  
+			add_obstacle(start_ind, ind, dist_mat[ind], sum2);  
 			
 		}	
 			
@@ -431,7 +1046,7 @@ void filter_correlate(void) {
 
 
 /** 
- * Get the obstacles from the Buffer
+ * Get the obstacles from the obstacle store (the most relevant one first) 
  * 
  * @param angle: Pointer to the angle, where the obstacle is detected (wrt. true North) []
  * @param dist:  Pointer to the distance to the obstacle [cm]
@@ -439,11 +1054,51 @@ void filter_correlate(void) {
  */
 bool measure_get_obstacles(uint16_t *angle, uint16_t *dist) {
 	
-	//Get the Obstacle-Object from the Buffer
-	buffer_get_values(&obst_buffer, angle, dist); 
+	static uint8_t index = 0;	//Next obstacle to be returned 
+	
+	uint8_t count = obstacles_sort(); 
+	const obstacle *obst = obstacles_get(index); 
+	
+	if(obst) {
+		*angle = obst->bearing; 
+		*dist = obst->distance; 
+		index++; 
+	}
+	
+	if(index >= count) {
+		//All obstacles were returned => remove them 
+		
+		obstacles_init(); 
+		index = 0; 
+		
+		return false; 
+	}
+	
+	return true; 
+}
+
+
+/**
+ * Store an obstacle found by the filter in the obstacle store 
+ *
+ * @param start_ind: Index of the first edge in the distance Matrix 
+ * @param end_ind: Index of the second edge in the distance Matrix 
+ * @param dist: Distance to the obstacle [cm] 
+ * @param jump: Jump of the distance at the edge 
+ * @return true, if the obstacle was stored (false, if it is less relevant than all stored obstacles) 
+ */
+bool add_obstacle(uint16_t start_ind, uint16_t end_ind, uint16_t dist, int16_t jump) {
+	
+	static uint8_t id = 0;	//Identifier of the last obstacle 
+	obstacle obst; 
+	
+	obst.obst_id = ++id; 
+	obst.bearing = (start_ind + (end_ind-start_ind)/2)*INTERVAL/ANGLE_RES; 
+	obst.distance = dist; 
+	obst.extent = (end_ind-start_ind)*INTERVAL/ANGLE_RES; 
+	obst.confidence = (jump > 255) ? 255 : ((jump < 0) ? 0 : jump); 
 	
-	//Return true as soon as the buffer is empty 
-	return !buffer_is_empty(&obst_buffer); 
+	return obstacles_add(&obst); 
 }
 
 
@@ -452,6 +1107,7 @@ bool measure_get_obstacles(uint16_t *angle, uint16_t *dist) {
 
 /**
  * Take the modulo for compass courses (account for discontinuity at 0->360)
+ * Note: The angles are given in 1/ANGLE_RES  
  * 
  * >360: angle-360
  * <360: 360-angle
@@ -459,16 +1115,16 @@ bool measure_get_obstacles(uint16_t *angle, uint16_t *dist) {
 uint16_t mod(int16_t angle) {
 
 
-		while(angle>360) {
-			angle = angle -  360;
+		while(angle>DEG(360)) {
+			angle = angle -  DEG(360);
 		}
 
-		while(angle<(-360)) {
-			angle = angle + 360;
+		while(angle<(-DEG(360))) {
+			angle = angle + DEG(360);
 		}
 
 		while(angle<0) {
-			angle = 360 + angle;
+			angle = DEG(360) + angle;
 		}
 
 		return angle;
@@ -18,6 +18,9 @@ void measure_handler(void);
 /* @brief Init the measurement */ 
 bool measure_init(void);
 
+/* @brief Start the calibration of the settle time of the servo using the LIDAR (runs in measure_handler()) */ 
+bool measure_calibrate(void);
+
 /* @brief Return the identified obstacles from the buffer */ 
 bool measure_get_obstacles(uint16_t *angle, uint16_t *dist);
 
@@ -27,6 +30,11 @@ uint16_t measure_get_distance(uint16_t angle);
 /* @brief Return the distance at a given Angle from the small Matrix*/ 
 uint16_t measure_get_distance_small(uint16_t ind);
 
+#if STORE_SIGNAL == 1
+/* @brief Return the signal strength at a given Angle from the small Matrix*/ 
+uint8_t measure_get_signal_small(uint16_t ind);
+#endif
+
 /* @brief Return the heading for which the small distance Matrix is valid */ 
 uint16_t measure_get_heading_valid(void);
 
@@ -0,0 +1,246 @@
+/*
+ * obstacles.c
+ *
+ * This file stores the detected obstacles ordered by their relevance. The score of an obstacle is 
+ * given by OBSTACLE_SCORE (lower == more relevant, e.g. the distance). 
+ *
+ * Note: The obstacles are kept in a max-heap (the least relevant obstacle is at the root). If the store is 
+ *       full, a new obstacle replaces the root only if it is more relevant => inserting is O(log n) and a 
+ *       close obstacle is never pushed out by distant clutter. 
+ *       For sending, the heap is sorted in place (most relevant first) and emptied afterwards. 
+ *
+ * Created: 17.10.2026 14:04:48
+ */ 
+
+#include "config.h"
+#include "obstacles.h"
+
+
+/************************************************************************/
+/* V A R I A B L E S                                                    */
+/************************************************************************/
+
+static obstacle heap[MAX_OBSTACLE_NUMBER];	//Stored obstacles (max-heap wrt. the score) 
+
+static struct {
+	uint8_t count;		//Number of stored obstacles 
+	bool sorted;		//true, if the obstacles are sorted (the heap is destroyed) 
+} state = {
+	.count = 0,
+	.sorted = false
+};
+
+
+
+/************************************************************************/
+/* F U N C T I O N    P R O T O T Y P E S                               */
+/************************************************************************/
+
+/* @brief Score of the obstacle at a position in the heap */ 
+uint16_t score(uint8_t ind); 
+
+/* @brief Exchange two obstacles */ 
+void swap(uint8_t a, uint8_t b); 
+
+/* @brief Move an obstacle up until its parent has a higher score */ 
+void sift_up(uint8_t ind); 
+
+/* @brief Move an obstacle down until its children have lower scores */ 
+void sift_down(uint8_t ind, uint8_t count); 
+
+
+
+
+/************************************************************************/
+/* P U B L I C    F U N C T I O N S                                     */
+/************************************************************************/
+
+/**
+ * Init the obstacle store => all obstacles are removed 
+ */
+void obstacles_init(void) {
+	
+	state.count = 0; 
+	state.sorted = false; 
+}
+
+
+
+/**
+ * Add an obstacle. If the store is full, the least relevant obstacle (highest score) is dropped. 
+ * Note: Adding an obstacle after obstacles_sort() removes all obstacles first 
+ *
+ * @param obst: Obstacle to be added 
+ * @return true, if the obstacle was stored, false if it was less relevant than all stored obstacles 
+ */
+bool obstacles_add(const obstacle *obst) {
+	
+	if(state.sorted) {
+		//The obstacles were sent => start over 
+		
+		obstacles_init(); 
+	}
+	
+	if(state.count < MAX_OBSTACLE_NUMBER) {
+		//There is space left => append the obstacle and restore the heap 
+		
+		heap[state.count] = *obst; 
+		sift_up(state.count); 
+		state.count++; 
+		
+		return true; 
+	}
+	
+	if(OBSTACLE_SCORE(obst) >= score(0)) {
+		//The new obstacle is less relevant than all stored obstacles 
+		
+		return false; 
+	}
+	
+	//Replace the least relevant obstacle 
+	heap[0] = *obst; 
+	sift_down(0, state.count); 
+	
+	return true; 
+}
+
+
+
+/**
+ * Get the number of stored obstacles 
+ *
+ * @return number of obstacles 
+ */
+uint8_t obstacles_get_count(void) {
+	
+	return state.count; 
+}
+
+
+
+/**
+ * Sort the obstacles, such that obstacles_get(0) returns the most relevant one (lowest score) 
+ * Note: The sorting is done in place (heap sort), the next call of obstacles_add() removes all obstacles 
+ *
+ * @return number of obstacles 
+ */
+uint8_t obstacles_sort(void) {
+	
+	if(!state.sorted) {
+		
+		//Move the root (highest score) to the end and restore the heap with the remaining obstacles 
+		for(uint8_t end = state.count; end > 1; end--) {
+			swap(0, end-1); 
+			sift_down(0, end-1); 
+		}
+		
+		state.sorted = true; 
+	}
+	
+	return state.count; 
+}
+
+
+
+/**
+ * Get a stored obstacle. Use obstacles_sort() first to get them in the order of their relevance 
+ *
+ * @param index: Position of the obstacle (0..count-1) 
+ * @return Pointer to the obstacle, NULL if there is no obstacle at the index 
+ */
+const obstacle *obstacles_get(uint8_t index) {
+	
+	if(index >= state.count) {
+		return 0; 
+	}
+	
+	return &heap[index]; 
+}
+
+
+
+
+
+/************************************************************************/
+/* P R I V A T E     F U N C T I O N S                                  */
+/************************************************************************/
+
+/**
+ * Get the score of an obstacle 
+ *
+ * @param ind: Position in the heap 
+ * @return score (lower == more relevant) 
+ */
+uint16_t score(uint8_t ind) {
+	
+	return OBSTACLE_SCORE(&heap[ind]); 
+}
+
+
+/**
+ * Exchange two obstacles in the heap 
+ *
+ * @param a: Position of the first obstacle 
+ * @param b: Position of the second obstacle 
+ */
+void swap(uint8_t a, uint8_t b) {
+	
+	obstacle tmp = heap[a]; 
+	heap[a] = heap[b]; 
+	heap[b] = tmp; 
+}
+
+
+/**
+ * Move an obstacle up until its parent has a higher score 
+ *
+ * @param ind: Position of the obstacle 
+ */
+void sift_up(uint8_t ind) {
+	
+	while(ind > 0) {
+		uint8_t parent = (ind-1)/2; 
+		
+		if(score(parent) >= score(ind)) {
+			//The heap is valid 
+			
+			break; 
+		}
+		
+		swap(parent, ind); 
+		ind = parent; 
+	}
+}
+
+
+/**
+ * Move an obstacle down until its children have lower scores 
+ *
+ * @param ind: Position of the obstacle 
+ * @param count: Number of obstacles in the heap 
+ */
+void sift_down(uint8_t ind, uint8_t count) {
+	
+	while(1) {
+		uint8_t largest = ind; 
+		uint8_t left = 2*ind + 1; 
+		uint8_t right = 2*ind + 2; 
+		
+		if(left < count && score(left) > score(largest)) {
+			largest = left; 
+		}
+		
+		if(right < count && score(right) > score(largest)) {
+			largest = right; 
+		}
+		
+		if(largest == ind) {
+			//The heap is valid 
+			
+			break; 
+		}
+		
+		swap(ind, largest); 
+		ind = largest; 
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * obstacles.h
+ *
+ * Created: 17.10.2026 14:05:12
+ */ 
+
+
+#ifndef OBSTACLES_H_
+#define OBSTACLES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pixhawk.h"
+
+
+/* @brief Remove all obstacles */ 
+void obstacles_init(void); 
+
+/* @brief Add an obstacle, the least relevant one is dropped if the store is full */ 
+bool obstacles_add(const obstacle *obst); 
+
+/* @brief Return the number of stored obstacles */ 
+uint8_t obstacles_get_count(void); 
+
+/* @brief Sort the obstacles, the most relevant one first */ 
+uint8_t obstacles_sort(void); 
+
+/* @brief Return a stored obstacle */ 
+const obstacle *obstacles_get(uint8_t index); 
+
+
+#endif /* OBSTACLES_H_ */
\ No newline at end of file
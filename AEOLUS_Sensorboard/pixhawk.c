@@ -6,40 +6,73 @@
  *
  * Further, it acts as the interface between the Pixhawk and the LIDAR Sensor 
  *
- * The protocol is as follows: 
+ * The protocol is as follows (requests and answers use the same frame): 
+ *    Command-Byte | length0 | length1 | ...length bytes of payload... | crc0 | crc1 | SLIP_END 
+ *    Note: All values are sent high byte first. The CRC is a CRC-16 (CCITT, start value 0xFFFF) over the command, 
+ *          the length and the payload. Inside the frame, SLIP_END and SLIP_ESC are escaped (SLIP, RFC 1055). 
  * 1) Read request from Pixhawk: 
- *    0x02 | 0x02 | Command-Byte | heading0 | heading1 | 0x03
- *    Note: heading0 and heading1 are the high and the low byte of the heading wrt. true north of the boat 
+ *    The payload is the heading wrt. true north of the boat (heading0 | heading1) or the value of a "SET"-Command 
  * 2) Answer to a read request 
- *    0x02 | 0x02 | Command-Byte | number of bytes |...variable length of data bytes dependent on the command... | 0x03
+ *    The payload is the data dependent on the command 
+ * 3) Pushed data (after CMD_SUBSCRIBE) 
+ *    Completed sectors and new obstacles are sent without a request, as soon as the measurement produces them 
  *
+ * Note: A lost or corrupted byte only destroys the current frame, the next SLIP_END starts a new one. 
  *
+ * With PIXHAWK_OUTPUT == PIXHAWK_MAVLINK, the protocol is replaced by MAVLink v2 OBSTACLE_DISTANCE messages, 
+ * which are sent after every completed sector and can be used by the autopilot directly. 
  *
  * Created: 02.04.2015 11:56:17
  *  Author: Jonas Wirz <wirzjo@student.ethz.ch>
  */ 
 
-/* 
- * TODO: 
- *   - Do not check, if we received Start or End-char when the heading bytes are sent! 
- */
-
 
 #include <stdbool.h>
 #include <avr/delay.h>
+#include <util/crc16.h>
+#include <avr/pgmspace.h>
 
 #include "config.h"
 #include "pixhawk.h"
 #include "serial.h"
+#include "buffer.h"
 #include "measure.h"
+#include "obstacles.h"
+#include "timer.h"
+#include "lidar.h"
+#include "port.h"
 
 
 /************************************************************************/
 /* V A R I A B L E S                                                    */
 /************************************************************************/
 
-typedef enum{IDLE,STARTCHAR, COMMAND, HEAD0, HEAD1, ENDCHAR, ERROR} state_enum;	
-static state_enum rx_state = IDLE;  //State for the receive-finite state machine
+typedef enum{RX_FRAME, RX_ESCAPE, RX_DISCARD} state_enum;	
+static state_enum rx_state = RX_FRAME;  //State for the receive-finite state machine
+
+#define RX_FRAME_SIZE 16			//Maximum size of a received frame (without SLIP_END) [bytes] 
+static uint8_t rx_frame[RX_FRAME_SIZE];	//Bytes of the frame being received (unescaped) 
+static uint8_t rx_length = 0;		//Number of bytes in rx_frame 
+
+static uint16_t tx_crc;				//CRC of the frame being sent 
+
+//Long frame being sent, its payload (distances) is produced while there is space in the transmit buffer 
+static struct {
+	uint8_t cmd;					//Command of the frame (0x00 == no long frame is being sent) 
+	uint16_t first;					//Index in the Matrix of the first distance 
+	uint16_t ind;					//Next word of the payload 
+	uint16_t end;					//Number of words of the payload 
+} tx = {
+	.cmd = 0x00
+};
+
+//Answer waiting to be sent (it is produced, when it is sent) 
+typedef struct {
+	uint8_t cmd;					//Command of the request 
+	uint8_t value;					//heading0 of the request (e.g. the profile of CMD_SET_BAUD) 
+} answer;
+
+BUFFER_DEFINE(answers, answer, 4);	//Answers in the order of the requests 
 
 static uint8_t cmd = 0x00;			//Last Command transmitted by the message
 static uint8_t head0 = 0x00;		//High byte of the heading 
@@ -47,14 +80,38 @@ static uint8_t head1 = 0x00;		//Low byte of the heading
 
 #define MAXNROFOBSTACLES 10			//Maximum number of obstacles that can be detected and reported to Pixhawk 
 
+#define NO_PROFILE 0xFF				//No baudrate change pending 
+
 
 static struct {
 	uint16_t heading;				//Current heading of the boat known from Pixhawk 
+	uint32_t baud;					//Current baudrate 
+	uint32_t baud_previous;			//Baudrate before the last change (restored, if the change is not confirmed) 
+	uint32_t baud_changed;			//Time of the last change of the baudrate [ms] 
+	bool baud_pending;				//true, until a request is received with the new baudrate 
+	uint8_t baud_profile;			//Profile to change to, as soon as the answer of CMD_SET_BAUD is sent (NO_PROFILE == none) 
+	uint8_t subscription;			//Data pushed to the Pixhawk without a request (SUB_ flags) 
+	uint16_t sector_first;			//First measurement of the sectors waiting to be pushed 
+	uint16_t sector_end;			//Index after the last one (== sector_first, if there is nothing to push) 
+	bool obstacles_pending;			//true, if the new obstacles are waiting to be pushed 
 } state = { 
-	.heading = 0
+	.heading = 0,
+	.baud = SERIAL_BAUD_38400,
+	.baud_previous = SERIAL_BAUD_38400,
+	.baud_changed = 0,
+	.baud_pending = false,
+	.baud_profile = NO_PROFILE,
+	.subscription = 0,
+	.sector_first = 0,
+	.sector_end = 0,
+	.obstacles_pending = false
 };
 
-static bool flag_send = false; 
+//Baudrates that can be chosen with CMD_SET_BAUD (index == profile, stored in the flash) 
+static const uint32_t baud_profiles[] PROGMEM = {SERIAL_BAUD_38400, SERIAL_BAUD_76800, SERIAL_BAUD_250000, SERIAL_BAUD_500000}; 
+
+#define BAUD_TIMEOUT 1000			//Time to receive a request with the new baudrate, before the old one is restored [ms] 
+
 
 
 
@@ -63,8 +120,16 @@ static bool flag_send = false;
 /* P R O T O C O L                                                      */
 /************************************************************************/
 
-#define MSG_START		0x02	//Start character for a message
-#define MSG_END			0x03	//End character for a message
+#define SLIP_END		0xC0	//End of a frame 
+#define SLIP_ESC		0xDB	//Start of an escape sequence 
+#define SLIP_ESC_END	0xDC	//SLIP_ESC, SLIP_ESC_END == SLIP_END inside a frame 
+#define SLIP_ESC_ESC	0xDD	//SLIP_ESC, SLIP_ESC_ESC == SLIP_ESC inside a frame 
+
+#define CRC_INIT		0xFFFF	//Start value of the CRC 
+
+#define FRAME_SPACE(n)	(7 + 2*(n) + 5)	//Bytes of a frame with n payload bytes, if every byte is escaped 
+#define FRAME_WORD_SPACE 4		//Bytes of an escaped word 
+#define FRAME_END_SPACE	5		//Bytes of the escaped CRC and SLIP_END 
 
 #define CMD_OBSTACLES	0x4F	//Send the bearings and distances to every obstacle in range
 								//Note: bearing (high/low byte) and then the distance is sent
@@ -73,9 +138,48 @@ static bool flag_send = false;
 #define CMD_DISTMAT1    0x4B    //Return the distance Matrix for 0-179 
 #define CMD_DISTMAT2    0x4C    //Return the distance Matrix for 180-355
 #define CMD_DISTMATSMALL 0x4D   //Return the distance Matrix for -RANGE to RANGE centered at the last known Boat-Heading	
+								//Note: The distances are read while the frame is sent => measurements done in the meantime 
+								//      may already be part of it 
 #define CMD_RESET       0x20    //Reset the Sensor to initial conditions 
+#define CMD_CALIBRATE   0x21    //Calibrate the settle time of the servo and restart the measurement 
+								//Note: The answer (1: new model stored, 0: failed or aborted by CMD_RESET, the old model is kept) 
+								//      is sent when the calibration is finished, about 20s after the request. There is no 
+								//      measurement in the meantime, but the other requests are answered 
 
 #define CMD_SET_THRESH  0x30    //Set the threshold for the obstacle Detection  
+#define CMD_SET_BAUD    0x31    //Change the baudrate, heading0 is the profile (0: 38400, 1: 76800, 2: 250000, 3: 500000) 
+								//Note: The answer (profile or 0xFF if not supported) is sent with the old baudrate. If no request 
+								//      is received with the new baudrate within BAUD_TIMEOUT, the old baudrate is restored 
+#define CMD_SUBSCRIBE   0x32    //Push data without a request, heading0 holds the SUB_ flags (0 == stop pushing) 
+								//Note: The answer contains the accepted flags 
+
+#define CMD_SECTOR      0x50    //Pushed: a completed sector of the small distance Matrix 
+								//Note: start angle (2 bytes), heading for which the Matrix is valid (2 bytes), then the distances 
+								//      Obstacles are pushed in the same frame as the answer to CMD_OBSTACLES 
+
+#define SUB_SECTORS     0x01    //Push every completed sector (CMD_SECTOR) 
+#define SUB_OBSTACLES   0x02    //Push the new obstacles after every sector (CMD_OBSTACLES) 
+
+
+
+
+/************************************************************************/
+/* M A V L I N K                                                        */
+/************************************************************************/
+
+#define MAV_STX			0xFD	//Start of a MAVLink v2 frame 
+#define MAV_MSG_ID		330		//OBSTACLE_DISTANCE 
+#define MAV_CRC_EXTRA	23		//CRC_EXTRA of OBSTACLE_DISTANCE (the extensions are not part of it) 
+#define MAV_LENGTH		167		//Payload: time_usec (8), distances (144), min/max_distance (4), sensor_type, increment, 
+								//increment_f (4), angle_offset (4), frame 
+#define MAV_BINS		72		//Number of distances in OBSTACLE_DISTANCE 
+#define MAV_INCREMENT	(DEG(2*RANGE)/MAV_BINS)	//Width of a bin [1/ANGLE_RES ] 
+#define MAV_MIN_DISTANCE 5		//Minimum distance the LIDAR can measure [cm] 
+#define MAV_UNKNOWN		0xFFFF	//Distance of a bin without a measurement 
+#define MAV_LASER		0		//MAV_DISTANCE_SENSOR_LASER 
+#define MAV_FRAME_BODY_FRD 12	//Angles are measured clockwise from the bow 
+#define MAV_BEGIN_SPACE	18		//Bytes of the start byte, the header and time_usec 
+#define MAV_END_SPACE	19		//Bytes after the distances (including the CRC) 
 
 
 
@@ -84,8 +188,68 @@ static bool flag_send = false;
 /* F U N C T I O N    P R O T O T Y P E S                               */
 /************************************************************************/
 
-/* @brief Send data to pixhawk */ 
-bool send2pixhawk(uint8_t cmd); 
+/* @brief Send the answer to a request (if there is space in the transmit buffer) */ 
+bool send2pixhawk(uint8_t cmd, uint8_t value); 
+
+/* @brief Send the waiting frames, as far as there is space in the transmit buffer */ 
+void pump(void); 
+
+/* @brief Start the next frame waiting to be sent */ 
+bool frame_next(void); 
+
+/* @brief Start a frame, whose payload (words) is sent by pump() */ 
+void frame_start(uint8_t cmd, uint16_t first, uint16_t words); 
+
+/* @brief Return a word of the payload of the frame being sent */ 
+uint16_t payload(uint16_t ind); 
+
+/* @brief Execute a complete request */ 
+void dispatch(void); 
+
+/* @brief Return true, if a baudrate profile can be used */ 
+bool baud_valid(uint8_t profile); 
+
+/* @brief Change to a baudrate profile */ 
+bool baud_switch(uint8_t profile); 
+
+/* @brief Check the length and the CRC of a received frame */ 
+bool check_frame(void); 
+
+/* @brief Start a frame (command and length) */ 
+void frame_begin(uint8_t cmd, uint16_t length); 
+
+/* @brief Send a byte of a frame */ 
+void frame_byte(uint8_t data); 
+
+/* @brief Send two bytes of a frame */ 
+void frame_word(uint16_t data); 
+
+/* @brief Finish a frame (CRC and SLIP_END) */ 
+void frame_end(void); 
+
+/* @brief Send a byte using the SLIP escape sequences */ 
+void send_escaped(uint8_t data); 
+
+/* @brief Send the stored obstacles (closest first) and remove them */ 
+void send_obstacles(void); 
+
+/* @brief Start a MAVLink OBSTACLE_DISTANCE message (header and time) */ 
+void mav_begin(void); 
+
+/* @brief Return the distance of a bin of the OBSTACLE_DISTANCE message */ 
+uint16_t mav_bin(uint8_t bin); 
+
+/* @brief Finish the OBSTACLE_DISTANCE message (fields after the distances and CRC) */ 
+void mav_end(void); 
+
+/* @brief Send a byte of a MAVLink frame */ 
+void mav_byte(uint8_t data); 
+
+/* @brief Send two bytes of a MAVLink frame (low byte first) */ 
+void mav_word(uint16_t data); 
+
+/* @brief Send a float of a MAVLink frame */ 
+void mav_float(float data); 
 
 
 
@@ -101,12 +265,25 @@ bool send2pixhawk(uint8_t cmd);
 bool pixhawk_init(void) {
 	
 	//Set the state of the parser
-	rx_state = IDLE; 
+	rx_state = RX_FRAME; 
+	rx_length = 0; 
 	
 	
 	//Init the serial communication 
-	serial_init(38400);	//for use with PIXHAWK
-	//serial_init(19200); 
+	state.baud = SERIAL_BAUD_38400;	//for use with PIXHAWK
+	state.baud_pending = false; 
+	serial_init(state.baud); 
+	
+	//Data is only sent on request, until the Pixhawk subscribes 
+	state.subscription = 0; 
+	
+	//Nothing to be sent yet 
+	answers_init(); 
+	tx.cmd = 0x00; 
+	state.baud_profile = NO_PROFILE; 
+	state.sector_first = 0; 
+	state.sector_end = 0; 
+	state.obstacles_pending = false; 
 	
 	return true; 
 }
@@ -114,123 +291,83 @@ bool pixhawk_init(void) {
 
 /**
  * Parsing new data that is available from the serial interface 
- * Note: This function is called by the "Receive completed interrupt"
+ * Note: This function is called by the pixhawk_handler() for every received byte. As soon as a 
+ *       request is complete, it is executed (the answer is queued and sent by pump()). 
  *
- * @param Pointer to a circular buffer 
+ * @param data: Received byte 
+ * @return false, if a corrupted frame was discarded 
  */
 bool pixhawk_parse(uint8_t data) {
 	
-	//Text starts with STX = 0x02 and ends with ETX = 0x03
-	//A message from the Pixhawk must have the following form: 
-	// 0x02 | 0x02 | 0xXX (Command byte) | 0x03 
+	//A frame from the Pixhawk ends with SLIP_END, the bytes SLIP_END and SLIP_ESC inside the frame are escaped: 
+	// Command-Byte | length (2 bytes) | payload | CRC (2 bytes) | SLIP_END 
+	
+	bool valid = true; 
 	
 	//Turn on LED to signal Data transfer 
 	port_led(true); 
 	
-	switch(rx_state) {
-		case IDLE: {
-			//The state machine is idle and waits for chars to be sent 
+	switch(data) {
+		case SLIP_END: {
+			//The frame is complete => check and execute it (empty frames are only used for synchronization) 
 			
-			if(data == MSG_START) {
-				//We received the first Start-Character
+			if(rx_state == RX_FRAME && rx_length > 0) {
+				
+				valid = check_frame(); 
 				
-				rx_state = STARTCHAR; 			 
+				if(valid) {
+					dispatch(); 
+				}
 			}
 			
+			//Start the next frame (a frame that was discarded ends here => resynchronization) 
+			rx_state = RX_FRAME; 
+			rx_length = 0; 
+			
 			break; 
 		}
-		case STARTCHAR: {
-			//The first Start-Character was sent and we are waiting for the second one now 
+		case SLIP_ESC: {
+			//The next byte is escaped 
 			
-			if(data == MSG_START) {
-				//We received the second Start-Character
-				
-				rx_state = COMMAND;
-				 
+			if(rx_state == RX_FRAME) {
+				rx_state = RX_ESCAPE; 
 			} else {
-				//No second Start-Character was sent => return to IDLE
-				
-				rx_state = IDLE; 
-			}	
-			
-			break;		
-		}
-		case COMMAND: {
-			//The second Start-Character was sent, now we expect to receive the Command 
-			
-			if(data == MSG_START || data == MSG_END) {
-				//We received again a Start or End Character or a 0 => ERROR 
-				//return to IDLE
+				//Two escape characters in a row are invalid 
 				
-				rx_state = IDLE; 
-			} else {
-				//The char is valid => store it 
-				
-				cmd = data; 
-				
-				rx_state = HEAD0; 
+				rx_state = RX_DISCARD; 
 			}
 			
 			break; 
 		}
-		case HEAD0: {
-			//The command was sent => expect to receive the "heading0" char 
-			//NOTE: We do not check, if we received a start or an End-Char, because it could happen that the heading contains one of these characters 
-
-			//The char is valid => store it
-			head0 = data; 
-			rx_state = HEAD1;
-			
-			break; 
-		}
-		case HEAD1: {
-			//The first heading byte was receives => expect to receive the second one 
-			//NOTE: We do not check, if we received a start or an End-Char, because it could happen that the heading contains one of these characters 
-			
-			//The char is valid => store it
-			head1 = data;
-			rx_state = ENDCHAR;
-						
-			break; 
-		}
-		case ENDCHAR: {
-			//The command byte was read and we wait for the end-byte 
+		default: {
 			
-			if(data == MSG_END) {
-				//We received the End Character => Data is valid 
-				
-				flag_send = true; 
+			if(rx_state == RX_ESCAPE) {
+				//Only SLIP_END and SLIP_ESC can be escaped 
 				
-				//For "SET"-Commands, the heading-bytes contain some variable information 
-				switch(cmd) {
-					case CMD_SET_THRESH: {
-						//Set the threshold of the Obstacle Detection 
-						
-						measure_set_threshold(((uint16_t)(head0<<8) || (uint16_t)(head1)));
-						
-						break; 
-					}
-					default: {
-						//Store the heading transmitted with the request
-						state.heading = (uint16_t)(head0<<8) || (uint16_t)(head1);
-					}									
-				} 
-				
-				rx_state = IDLE; 
-			
-			} else {
-				//Some error occurred => return to IDLE
-		 				
-				rx_state = IDLE;
+				if(data == SLIP_ESC_END) {
+					data = SLIP_END; 
+					rx_state = RX_FRAME; 
+				} else if(data == SLIP_ESC_ESC) {
+					data = SLIP_ESC; 
+					rx_state = RX_FRAME; 
+				} else {
+					rx_state = RX_DISCARD; 
+				}
 			}
 			
-			break; 
-		}
-		default: {
-			//This code should never be reached
-			//Nothing we can do about, if we reach it...just go back to IDLE
-			
-			rx_state = IDLE; 
+			if(rx_state == RX_FRAME) {
+				
+				if(rx_length < RX_FRAME_SIZE) {
+					//Store the byte 
+					
+					rx_frame[rx_length] = data; 
+					rx_length++; 
+				} else {
+					//The frame is too long => wait for the next frame 
+					
+					rx_state = RX_DISCARD; 
+				}
+			}
 			
 			break; 
 		}
@@ -240,11 +377,87 @@ bool pixhawk_parse(uint8_t data) {
 	port_led(false); 
 	
 	
-	return true; 
+	return valid; 
 }
 
 
 
+/**
+ * Push a completed sector of the small distance Matrix to the Pixhawk 
+ * Note: The sector is only sent, if the Pixhawk subscribed to the sectors. It is sent by the pixhawk_handler(), 
+ *       sectors that are still waiting are sent in the same frame. 
+ *       With MAVLink, the autopilot gets the whole scan with the new sector. 
+ *
+ * @param first: Index of the first measurement of the sector in the small Matrix 
+ * @param count: Number of measurements in the sector 
+ */
+void pixhawk_push_sector(uint16_t first, uint16_t count) {
+	
+	#if PIXHAWK_OUTPUT == PIXHAWK_CUSTOM
+		if(!(state.subscription & SUB_SECTORS)) {
+			return; 
+		}
+	#endif
+	
+	if(first >= DEG(2*RANGE)/INTERVAL) {
+		return; 
+	}
+	
+	uint16_t end = first + count; 
+	
+	if(end > DEG(2*RANGE)/INTERVAL) {
+		//The last sector may be smaller 
+		
+		end = DEG(2*RANGE)/INTERVAL; 
+	}
+	
+	if(state.sector_end == state.sector_first) {
+		//Nothing is waiting 
+		
+		state.sector_first = first; 
+		state.sector_end = end; 
+	} else {
+		//Send the waiting sectors and the new one together 
+		
+		state.sector_first = (first < state.sector_first) ? first : state.sector_first; 
+		state.sector_end = (end > state.sector_end) ? end : state.sector_end; 
+	}
+}
+
+
+/**
+ * Push the new obstacles to the Pixhawk 
+ * Note: The obstacles are only sent (and removed), if the Pixhawk subscribed to the obstacles and there are any 
+ */
+void pixhawk_push_obstacles(void) {
+	
+	//Note: MAVLink only gets the distances (pushed with the sectors) 
+	#if PIXHAWK_OUTPUT == PIXHAWK_CUSTOM
+	
+		if(!(state.subscription & SUB_OBSTACLES) || obstacles_get_count() == 0) {
+			return; 
+		}
+		
+		//Sent by the pixhawk_handler() 
+		state.obstacles_pending = true; 
+	
+	#endif
+}
+
+
+/**
+ * Send the result of the calibration of the servo, as answer to CMD_CALIBRATE 
+ *
+ * @param stored: true, if a new motion model was stored 
+ */
+void pixhawk_push_calibration(bool stored) {
+	
+	//Sent by the pixhawk_handler() like the answer to any other request 
+	answer result = {CMD_CALIBRATE, stored ? 1 : 0}; 
+	answers_add(&result); 
+}
+
+
 /**
  * Get the last known Heading of the boat
  *
@@ -255,28 +468,39 @@ uint16_t pixhawk_get_heading(void) {
 
 
 /**
- * Handle repetitive tasks like sending data 
+ * Handle repetitive tasks like parsing the received data and sending the answers 
  * Note: This function should be called in every program loop 
  * 
  */
 void pixhawk_handler(void) {
-
-	if(flag_send) {
-		//Data needs to be sent 
-		//port_led_blink(2);
-		
-		//serial_send_byte(cmd); 
-		send2pixhawk(cmd); 
+	
+	uint8_t data[8];	//Bytes read from the receive buffer at once 
+	uint8_t n; 
+	
+	//Parse everything that was received since the last call (several requests may be executed) 
+	while((n = serial_receive(data, sizeof(data))) > 0) {
 		
-		cmd = 0x00;
-		flag_send = false;  
+		#if PIXHAWK_OUTPUT == PIXHAWK_CUSTOM
+		for(uint8_t i = 0; i < n; i++) {
+			pixhawk_parse(data[i]); 
+		}
+		#endif
+		//Note: With MAVLink, the messages of the autopilot are not used => they are discarded 
+	}
+	
+	if(state.baud_pending && (timer_get_ms() - state.baud_changed) > BAUD_TIMEOUT) {
+		//The Pixhawk did not send a request with the new baudrate => restore the old one 
 		
-		#if DEBUG_MATLAB == 1
-		//Do the next measurement step
-		//measure_handler();  
-		#endif 
+		serial_set_baud(state.baud_previous); 
+		state.baud = state.baud_previous; 
+		state.baud_pending = false; 
 		
+		rx_state = RX_FRAME; 
+		rx_length = 0; 
 	}
+	
+	//Send the answers and the pushed data (as far as there is space in the transmit buffer) 
+	pump(); 
 }
 
 
@@ -287,143 +511,707 @@ void pixhawk_handler(void) {
 /************************************************************************/
 
 /**
- * Send data to Pixhawk 
- *
- * @param cmd: Command that was sent last 
+ * Execute a complete request, which was received by the parser 
  */
-bool send2pixhawk(uint8_t cmd) {
+void dispatch(void) {
+	
+	//The request was received with the current baudrate => it works 
+	state.baud_pending = false; 
 	
-	//First handle all Commands that do not need to send data back 
+	//For "SET"-Commands, the heading-bytes contain some variable information 
+	switch(cmd) {
+		case CMD_SET_THRESH: {
+			//Set the threshold of the Obstacle Detection 
+			
+			measure_set_threshold(((uint16_t)(head0<<8) | (uint16_t)(head1)));
+			
+			break; 
+		}
+		case CMD_SET_BAUD: {
+			//The baudrate is changed after the answer was sent 
+			
+			break; 
+		}
+		case CMD_SUBSCRIBE: {
+			//Push the data from now on (unknown flags are ignored) 
+			
+			state.subscription = head0 & (SUB_SECTORS | SUB_OBSTACLES); 
+			
+			break; 
+		}
+		default: {
+			//Store the heading transmitted with the request
+			state.heading = (uint16_t)(head0<<8) | (uint16_t)(head1);
+		}
+	}
+	
+	//Execute the commands that do not need to send data back 
 	switch(cmd) {
 		case CMD_RESET: {
 			//Reset the Sensor to initial conditions 
 			
 			measure_init(); 
-			return true;  
+			break; 
+		}
+		case CMD_CALIBRATE: {
+			//Calibrate the servo (runs for about 20s in the measure_handler(), then the measurement is restarted) 
+			//Note: The answer is sent, when the calibration is finished (see pixhawk_push_calibration()) 
+			
+			measure_calibrate(); 
+			
+			cmd = 0x00; 
+			return; 
 		}
 		default: {
-			//If we reach this point, the command requires to send some data 
-		}		
+		}
+	}
+	
+	//The answer is sent by pump() (the baudrate of CMD_SET_BAUD is changed after the answer was sent) 
+	//Note: If too many answers are waiting, the request is not answered => the Pixhawk has to repeat it 
+	answer next = {cmd, head0}; 
+	answers_add(&next); 
+	
+	cmd = 0x00; 
+	
+	#if DEBUG_MATLAB == 1
+	//Do the next measurement step
+	//measure_handler();  
+	#endif 
+}
+
+
+/**
+ * Check, if a baudrate profile can be used with F_CPU 
+ *
+ * @param profile: Index in baud_profiles 
+ * @return true, if the profile exists and its error is within SERIAL_BAUD_TOLERANCE 
+ */
+bool baud_valid(uint8_t profile) {
+	
+	if(profile >= sizeof(baud_profiles)/sizeof(baud_profiles[0])) {
+		return false; 
+	}
+	
+	int16_t error = serial_baud_error(pgm_read_dword(&baud_profiles[profile])); 
+	
+	return (error <= SERIAL_BAUD_TOLERANCE && error >= -SERIAL_BAUD_TOLERANCE); 
+}
+
+
+/**
+ * Change to a baudrate profile. The change has to be confirmed by a request within BAUD_TIMEOUT 
+ *
+ * @param profile: Index in baud_profiles 
+ * @return true, if the baudrate was changed 
+ */
+bool baud_switch(uint8_t profile) {
+	
+	if(!baud_valid(profile)) {
+		return false; 
 	}
 	
+	uint32_t baud = pgm_read_dword(&baud_profiles[profile]); 
 	
+	if(baud == state.baud) {
+		//Nothing to do 
+		
+		return false; 
+	}
 	
+	if(!serial_set_baud(baud)) {
+		return false; 
+	}
+	
+	state.baud_previous = state.baud; 
+	state.baud = baud; 
+	state.baud_changed = timer_get_ms(); 
+	state.baud_pending = true; 
 	
-	//Send start-sequence => Initialize Message 
-	serial_send_byte(MSG_START);
-	serial_send_byte(MSG_START);
+	return true; 
+}
+
+
+/**
+ * Send the answer to a request 
+ * Note: The short answers are sent completely, the distance Matrices are started here and sent by pump(). 
+ *       The function never waits: if there is not enough space in the transmit buffer, nothing is sent. 
+ *
+ * @param cmd: Command of the request 
+ * @param value: heading0 of the request 
+ * @return false, if there is not enough space in the transmit buffer (try again later) 
+ */
+bool send2pixhawk(uint8_t cmd, uint8_t value) {
 	
-	//Send Command number 
-	serial_send_byte(cmd); 
+	//Space for the longest answer that is sent completely (the obstacles) 
+	if(serial_tx_free() < FRAME_SPACE(4*MAX_OBSTACLE_NUMBER)) {
+		return false; 
+	}
 	
 	//Send individual data 
 	switch(cmd) {
 		case CMD_OBSTACLES: {
 			
-			//Send the number of bytes 
-			serial_send_byte(buffer_get_size(&obst_buffer)*4); 
-			//Size is: 2 Values for each obstacle, 2 Bytes for each value => 2x2=4
+			//The whole frame is sent (the same frame is pushed) 
+			send_obstacles(); 
 			
+			return true; 
+		}
+		case CMD_NUMOFSTACLES: {
 			
-			while(!buffer_is_empty(&obst_buffer)) {
-				//As long as there are values in the buffer send the data 
-				
-				uint16_t heading = 0; 
-				uint16_t distance = 0;
-				
-				buffer_get_values(&obst_buffer, &heading, &distance);  
-				
-				serial_send_byte((uint8_t)(heading>>8));  //High byte of bearing
-				serial_send_byte((uint8_t)(heading));		 //Low byte of bearing
-				serial_send_byte((uint8_t)(distance>>8)); //High byte of distance
-				serial_send_byte((uint8_t)(distance));		 //Low byte of distance
-			}
+			//Send the number of Obstacles 
+			frame_begin(cmd, 1); 
+			frame_byte(obstacles_get_count()); 
 			
 			break; 
 		}
-		case CMD_NUMOFSTACLES: {
+		case CMD_SET_BAUD: {
 			
-			//Send the number of bytes that will be transmitted
-			serial_send_byte(0x01); 
+			//Send the accepted profile, the baudrate is changed as soon as it is sent 
+			frame_begin(cmd, 1); 
+			frame_byte(baud_valid(value) ? value : 0xFF); 
 			
-			//Send the number of Obstacles 
-			serial_send_byte(buffer_get_size(&obst_buffer)); 
+			state.baud_profile = value; 
 			
 			break; 
 		}
-		case CMD_LASTDIST: {
-			//Return the last measured distance by the LIDAR in two bytes (high-byte first) 
+		case CMD_SUBSCRIBE: {
 			
-			//Send the number of bytes that will be transmitted 
-			serial_send_byte(0x02); 
+			//Send the accepted flags 
+			frame_begin(cmd, 1); 
+			frame_byte(state.subscription); 
 			
-			//Get the distance from the LIDAR
-			uint16_t dist = lidar_get_distance();
+			break; 
+		}
+		case CMD_CALIBRATE: {
 			
-			//Send the distance as high and low byte to the Pixhawk 
-			serial_send_byte((uint8_t)(dist>>8)); 
-			serial_send_byte((uint8_t)(dist)); 
+			//Send the result of the calibration (1 == new model stored) 
+			frame_begin(cmd, 1); 
+			frame_byte(value); 
+			
+			break; 
+		}
+		case CMD_LASTDIST: {
+			//Return the last measured distance by the LIDAR in two bytes (high-byte first) 
+			
+			frame_begin(cmd, 2); 
+			frame_word(lidar_get_distance(0)); 
 			
 			break; 
 		}
 		case CMD_DISTMAT1: {
 			//Return the first half of the Distance-Matrix 0-179
 			
-			serial_send_byte(360/INTERVAL); //Number of Bytes 
+			frame_start(cmd, 0, DEG(360)/INTERVAL/2); 
 			
-			for(uint16_t ind = 0; ind < 360/INTERVAL/2; ind++) {
-				uint16_t dist = measure_get_distance(ind); 
-				serial_send_byte((uint8_t)(dist>>8));
-				serial_send_byte((uint8_t)(dist));
-			}
-			
-			break; 
+			return true; 
 		}
 		case CMD_DISTMAT2: {
 			//Return the second half of the Distance-Matrix 180-359
 			
-			serial_send_byte(360/INTERVAL); //Number of Bytes (2 bytes per distance) 
-			
-			for(uint16_t ind = 360/INTERVAL/2; ind < 360/INTERVAL; ind++) {
-				uint16_t dist = measure_get_distance(ind);
-				serial_send_byte((uint8_t)(dist>>8));
-				serial_send_byte((uint8_t)(dist));
-			}
+			frame_start(cmd, DEG(360)/INTERVAL/2, DEG(360)/INTERVAL/2); 
 			
-			break;
+			return true; 
 		}
 		case CMD_DISTMATSMALL: {
 			//Return the Distances from -RANGE to RANGE, centered at the last known boat-heading
 			//NOTE: The first two bytes are the heading of the boat! 
 			
-			//Number of Bytes (Distances plus 2bytes for heading) 
-			serial_send_byte(2*RANGE/INTERVAL*2 + 2); 
+			frame_start(cmd, 0, DEG(2*RANGE)/INTERVAL + 1); 
+			
+			return true; 
+		}
+		default: {
+			//The command has no answer (e.g. CMD_RESET) or is invalid 
 			
-			//Heading for which the measurements are valid 
-			uint16_t heading_valid = measure_get_heading_valid(); 
-			serial_send_byte((uint8_t)(heading_valid>>8));
-			serial_send_byte((uint8_t)(heading_valid));
+			return true; 
+		}
+	}
+	
+	//Send the CRC and the end of the frame 
+	frame_end(); 
+	
+	return true; 
+}
+
+
+/**
+ * Send the waiting frames: first the answers (in the order of the requests), then the pushed data 
+ * Note: The payload of the long frames is produced word by word, as long as there is space in the transmit buffer. 
+ *       Therefore, the transmit buffer can be much smaller than a frame and the main loop never waits for the UART. 
+ *       The remaining words are sent in the next call. 
+ */
+void pump(void) {
+	
+	while(true) {
+		
+		if(state.baud_profile != NO_PROFILE) {
+			//The answer of CMD_SET_BAUD is sent with the old baudrate => wait until it left the buffer 
 			
-			//The distances stored in the matrix 
-			for(uint16_t ind = 0; ind < 2*RANGE/INTERVAL; ind++) {
-				uint16_t dist = measure_get_distance_small(ind);
-				serial_send_byte((uint8_t)(dist>>8));
-				serial_send_byte((uint8_t)(dist));
+			if(serial_tx_busy()) {
+				return; 
 			}
 			
-			break; 
+			baud_switch(state.baud_profile); 
+			state.baud_profile = NO_PROFILE; 
 		}
-		default: {
-			//An invalid command was sent => might flag unhappy...
+		
+		if(tx.cmd == 0x00) {
+			//Start the next frame (the short ones are sent completely) 
+			
+			if(!frame_next()) {
+				//Nothing to send or not enough space 
+				
+				return; 
+			}
+			
+			continue; 
+		}
+		
+		//Send the payload of the long frame 
+		while(tx.ind < tx.end) {
 			
-			//port_led_blink(2); 
+			#if PIXHAWK_OUTPUT == PIXHAWK_MAVLINK
+				if(serial_tx_free() < 2) {
+					return; 
+				}
+				
+				mav_word(mav_bin(tx.ind)); 
+			#else
+				if(serial_tx_free() < FRAME_WORD_SPACE) {
+					return; 
+				}
+				
+				frame_word(payload(tx.ind)); 
+			#endif
 			
+			tx.ind++; 
+		}
+		
+		//Finish it 
+		#if PIXHAWK_OUTPUT == PIXHAWK_MAVLINK
+			if(serial_tx_free() < MAV_END_SPACE) {
+				return; 
+			}
+			
+			mav_end(); 
+		#else
+			if(serial_tx_free() < FRAME_END_SPACE) {
+				return; 
+			}
+			
+			frame_end(); 
+		#endif
+		
+		tx.cmd = 0x00; 
+	}
+}
+
+
+/**
+ * Start the next frame waiting to be sent 
+ *
+ * @return false, if there is nothing to send or not enough space in the transmit buffer 
+ */
+bool frame_next(void) {
+	
+	if(answers_size() > 0) {
+		//Answer the oldest request 
+		
+		const answer *next = answers_peek(0); 
+		
+		if(!send2pixhawk(next->cmd, next->value)) {
+			return false; 
+		}
+		
+		answers_pop_n(1); 
+		
+		return true; 
+	}
+	
+	if(state.sector_end > state.sector_first) {
+		//Push the completed sectors 
+		
+		#if PIXHAWK_OUTPUT == PIXHAWK_MAVLINK
+			if(serial_tx_free() < MAV_BEGIN_SPACE) {
+				return false; 
+			}
+			
+			mav_begin(); 
+		#else
+			if(serial_tx_free() < FRAME_SPACE(0)) {
+				return false; 
+			}
+			
+			//Start angle and heading, then the distances 
+			frame_start(CMD_SECTOR, state.sector_first, state.sector_end - state.sector_first + 2); 
+		#endif
+		
+		state.sector_first = 0; 
+		state.sector_end = 0; 
+		
+		return true; 
+	}
+	
+	if(state.obstacles_pending) {
+		//Push the new obstacles (they may have been removed by CMD_OBSTACLES in the meantime) 
+		
+		if(serial_tx_free() < FRAME_SPACE(4*MAX_OBSTACLE_NUMBER)) {
 			return false; 
 		}
+		
+		if(obstacles_get_count() > 0) {
+			send_obstacles(); 
+		}
+		
+		state.obstacles_pending = false; 
+		
+		return true; 
+	}
+	
+	return false; 
+}
+
+
+/**
+ * Start a frame, whose payload consists of words produced by payload() 
+ *
+ * @param cmd: Command of the frame 
+ * @param first: Index of the first distance in the Matrix 
+ * @param words: Number of words of the payload 
+ */
+void frame_start(uint8_t cmd, uint16_t first, uint16_t words) {
+	
+	frame_begin(cmd, words*2); 
+	
+	tx.cmd = cmd; 
+	tx.first = first; 
+	tx.ind = 0; 
+	tx.end = words; 
+}
+
+
+/**
+ * Get a word of the payload of the long frame being sent 
+ *
+ * @param ind: Index of the word in the payload 
+ * @return Value of the word 
+ */
+uint16_t payload(uint16_t ind) {
+	
+	switch(tx.cmd) {
+		case CMD_DISTMATSMALL: {
+			//Heading for which the measurements are valid, then the distances 
+			
+			if(ind == 0) {
+				return measure_get_heading_valid(); 
+			}
+			
+			return measure_get_distance_small(tx.first + ind - 1); 
+		}
+		case CMD_SECTOR: {
+			//Start angle [1/ANGLE_RES ], heading for which the measurements are valid, then the distances 
+			
+			if(ind == 0) {
+				return tx.first*INTERVAL; 
+			}
+			
+			if(ind == 1) {
+				return measure_get_heading_valid(); 
+			}
+			
+			return measure_get_distance_small(tx.first + ind - 2); 
+		}
+		default: {
+			//CMD_DISTMAT1, CMD_DISTMAT2 
+			
+			return measure_get_distance(tx.first + ind); 
+		}
+	}
+}
+
+
+/**
+ * Send the stored obstacles in one frame (CMD_OBSTACLES) and remove them 
+ * Note: The obstacles are sent closest first => the Pixhawk can stop reading after the first few 
+ */
+void send_obstacles(void) {
+	
+	uint8_t count = obstacles_sort(); 
+	
+	//Size is: 2 Values for each obstacle, 2 Bytes for each value => 2x2=4
+	frame_begin(CMD_OBSTACLES, (uint16_t)count*4); 
+	
+	for(uint8_t i = 0; i < count; i++) {
+		//Send the obstacles in the store without copying them 
+		
+		const obstacle *obst = obstacles_get(i); 
+		
+		frame_word(obst->bearing);		//Bearing (high byte first) 
+		frame_word(obst->distance);		//Distance (high byte first) 
+	}
+	
+	frame_end(); 
+	
+	//The obstacles are sent => remove them all at once 
+	obstacles_init(); 
+}
+
+
+/**
+ * Start the small distance Matrix as MAVLink v2 OBSTACLE_DISTANCE message, the distances (see mav_bin()) are sent 
+ * by pump(), then the message is finished by mav_end() 
+ * Note: All values are sent low byte first, the CRC is the X.25 CRC (same as _crc_ccitt_update) 
+ */
+void mav_begin(void) {
+	
+	static uint8_t seq = 0;		//Sequence number of the frame 
+	
+	//Header (the start byte is not part of the CRC) 
+	serial_send_byte(MAV_STX); 
+	tx_crc = CRC_INIT; 
+	
+	mav_byte(MAV_LENGTH); 
+	mav_byte(0x00);				//incompat_flags (not signed) 
+	mav_byte(0x00);				//compat_flags 
+	mav_byte(seq++); 
+	mav_byte(MAVLINK_SYSTEM_ID); 
+	mav_byte(MAVLINK_COMPONENT_ID); 
+	mav_word((uint16_t)MAV_MSG_ID); 
+	mav_byte((uint8_t)((uint32_t)MAV_MSG_ID>>16)); 
+	
+	//time_usec 
+	uint32_t time = timer_get_ms(); 
+	uint64_t time_usec = (uint64_t)time*1000; 
+	for(uint8_t i = 0; i < 8; i++) {
+		mav_byte((uint8_t)(time_usec>>(8*i))); 
+	}
+	
+	//The distances follow 
+	tx.cmd = MAV_STX; 
+	tx.first = 0; 
+	tx.ind = 0; 
+	tx.end = MAV_BINS; 
+}
+
+
+/**
+ * Get the distance of a bin of the OBSTACLE_DISTANCE message 
+ * Note: The bins start at -RANGE (backboard) and go clockwise, angle_offset is the center of the first bin. 
+ *       Every bin gets the smallest distance measured in it, bins without a measurement are MAV_UNKNOWN 
+ *       and "nothing detected" is sent as max_distance+1. 
+ *
+ * @param bin: Index of the bin (0 == backboard) 
+ * @return Distance [cm] 
+ */
+uint16_t mav_bin(uint8_t bin) {
+	
+	//The bin covers the angles [lo, hi) of the small Matrix (0 == starboard) => every measurement is in one bin 
+	uint16_t hi = DEG(2*RANGE) - bin*MAV_INCREMENT; 
+	uint16_t lo = hi - MAV_INCREMENT; 
+	uint16_t dist = MAV_UNKNOWN; 
+	
+	for(uint16_t ind = (lo + INTERVAL - 1)/INTERVAL; ind*INTERVAL < hi && ind < DEG(2*RANGE)/INTERVAL; ind++) {
+		uint16_t value = measure_get_distance_small(ind); 
+		
+		if(value == 0) {
+			//Not measured (yet) 
+			
+			continue; 
+		}
+		
+		if(value >= LIDAR_MAX_DISTANCE) {
+			//Nothing detected 
+			
+			value = LIDAR_MAX_DISTANCE + 1; 
+		}
+		
+		if(value < dist) {
+			dist = value; 
+		}
+	}
+	
+	return dist; 
+}
+
+
+/**
+ * Finish the OBSTACLE_DISTANCE message: the fields after the distances and the checksum 
+ */
+void mav_end(void) {
+	
+	mav_word(MAV_MIN_DISTANCE);					//min_distance 
+	mav_word(LIDAR_MAX_DISTANCE);				//max_distance 
+	mav_byte(MAV_LASER);						//sensor_type 
+	mav_byte((MAV_INCREMENT + ANGLE_RES - 1)/ANGLE_RES);	//increment (rounded up, increment_f is used) 
+	mav_float((float)MAV_INCREMENT/ANGLE_RES);	//increment_f 
+	mav_float((float)MAV_INCREMENT/(2*ANGLE_RES) - RANGE);	//angle_offset (center of the first bin) 
+	mav_byte(MAV_FRAME_BODY_FRD);				//frame (not zero => the payload does not need to be truncated) 
+	
+	//Checksum 
+	uint16_t crc = _crc_ccitt_update(tx_crc, MAV_CRC_EXTRA); 
+	serial_send_byte((uint8_t)(crc)); 
+	serial_send_byte((uint8_t)(crc>>8)); 
+}
+
+
+/**
+ * Send a byte of a MAVLink frame 
+ *
+ * @param data: Byte to be sent 
+ */
+void mav_byte(uint8_t data) {
+	
+	tx_crc = _crc_ccitt_update(tx_crc, data); 
+	serial_send_byte(data); 
+}
+
+
+/**
+ * Send two bytes of a MAVLink frame (low byte first) 
+ *
+ * @param data: Value to be sent 
+ */
+void mav_word(uint16_t data) {
+	
+	mav_byte((uint8_t)(data)); 
+	mav_byte((uint8_t)(data>>8)); 
+}
+
+
+/**
+ * Send a float of a MAVLink frame 
+ * Note: The float is stored as IEEE 754 single precision, low byte first (as on the AVR) 
+ *
+ * @param data: Value to be sent 
+ */
+void mav_float(float data) {
+	
+	union {
+		float value; 
+		uint8_t bytes[4]; 
+	} f; 
+	
+	f.value = data; 
+	
+	for(uint8_t i = 0; i < 4; i++) {
+		mav_byte(f.bytes[i]); 
+	}
+}
+
+
+/**
+ * Check a received frame (length and CRC) and extract the request 
+ *
+ * @return true, if the frame is valid 
+ */
+bool check_frame(void) {
+	
+	//The frame consists of at least the command, the length and the CRC 
+	if(rx_length < 5) {
+		return false; 
+	}
+	
+	uint16_t length = ((uint16_t)rx_frame[1]<<8) | rx_frame[2]; 
+	
+	if(length != rx_length - 5) {
+		return false; 
+	}
+	
+	//The CRC over the whole frame (including the CRC itself) is zero 
+	uint16_t crc = CRC_INIT; 
+	
+	for(uint8_t i = 0; i < rx_length; i++) {
+		crc = _crc_xmodem_update(crc, rx_frame[i]); 
 	}
 	
-	//Send end of Message 
-	serial_send_byte(MSG_END);
+	if(crc != 0) {
+		return false; 
+	}
+	
+	//Extract the request (the payload is the heading or the value of a "SET"-Command) 
+	cmd = rx_frame[0]; 
+	head0 = (length > 0) ? rx_frame[3] : 0x00; 
+	head1 = (length > 1) ? rx_frame[4] : 0x00; 
 	
+	return true; 
 }
 
+
+/**
+ * Start a frame 
+ * Note: A SLIP_END is sent first, such that the receiver discards any noise received before 
+ *
+ * @param cmd: Command, which is answered 
+ * @param length: Number of payload bytes 
+ */
+void frame_begin(uint8_t cmd, uint16_t length) {
+	
+	serial_send_byte(SLIP_END); 
+	
+	tx_crc = CRC_INIT; 
+	frame_byte(cmd); 
+	frame_word(length); 
+}
+
+
+/**
+ * Send a byte of a frame 
+ *
+ * @param data: Byte to be sent (escaped, if needed) 
+ */
+void frame_byte(uint8_t data) {
+	
+	tx_crc = _crc_xmodem_update(tx_crc, data); 
+	send_escaped(data); 
+}
+
+
+/**
+ * Send two bytes of a frame (high byte first) 
+ *
+ * @param data: Value to be sent 
+ */
+void frame_word(uint16_t data) {
+	
+	frame_byte((uint8_t)(data>>8)); 
+	frame_byte((uint8_t)(data)); 
+}
+
+
+/**
+ * Finish a frame by sending the CRC (high byte first) and SLIP_END 
+ */
+void frame_end(void) {
+	
+	uint16_t crc = tx_crc; 
+	
+	send_escaped((uint8_t)(crc>>8)); 
+	send_escaped((uint8_t)(crc)); 
+	
+	serial_send_byte(SLIP_END); 
+}
+
+
+/**
+ * Send a byte, SLIP_END and SLIP_ESC are replaced by an escape sequence 
+ *
+ * @param data: Byte to be sent 
+ */
+void send_escaped(uint8_t data) {
+	
+	switch(data) {
+		case SLIP_END: {
+			serial_send_byte(SLIP_ESC); 
+			serial_send_byte(SLIP_ESC_END); 
+			break; 
+		}
+		case SLIP_ESC: {
+			serial_send_byte(SLIP_ESC); 
+			serial_send_byte(SLIP_ESC_ESC); 
+			break; 
+		}
+		default: {
+			serial_send_byte(data); 
+		}
+	}
+}
@@ -11,11 +11,12 @@
 
 #include <stdint.h>
 
-//Definition of an obstacle-object 
+//Definition of an obstacle-object (record stored in the obstacle buffer) 
 typedef struct obstacle_s {
-	float bearing;		//bearing of the obstacle (element of [-180...0...+180]
-						//positive bearing <=> starboard side of the boat, 0 directly ahead)
-	float distance;		//distance to an obstacle [m]
+	uint16_t bearing;	//bearing of the middle of the obstacle wrt. true north [] 
+	uint16_t distance;	//distance to the obstacle [cm] 
+	uint8_t extent;		//angular width of the obstacle [] 
+	uint8_t confidence;	//strength of the detection (jump of the distance at the edges, saturated at 255) 
 	uint8_t obst_id;	//unique identifier of the obstacle 
 } obstacle; 
 
@@ -23,7 +24,7 @@ typedef struct obstacle_s {
 /* @brief Init the communication with the pixhawk */ 
 bool pixhawk_init(void); 
 
-/* @brief Parse data from the serial rx_buffer */ 
+/* @brief Parse a byte received from the Pixhawk */ 
 bool pixhawk_parse(uint8_t data);
 
 /* @brief Handle repetitive tasks */  
@@ -32,5 +33,14 @@ void pixhawk_handler(void);
 /* @brief Get the last knonw Heading of the boat */ 
 uint16_t pixhawk_get_heading(void); 
 
+/* @brief Push a completed sector of the small distance Matrix (if subscribed) */ 
+void pixhawk_push_sector(uint16_t first, uint16_t count); 
+
+/* @brief Push the new obstacles (if subscribed) */ 
+void pixhawk_push_obstacles(void); 
+
+/* @brief Send the result of the calibration (answer to CMD_CALIBRATE) */ 
+void pixhawk_push_calibration(bool stored); 
+
 
 #endif /* PIXHAWK_H_ */
\ No newline at end of file
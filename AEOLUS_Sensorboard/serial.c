@@ -3,6 +3,9 @@
  *
  * This file contains functions for serial communication using the ATMEL's USART interface
  *
+ * Note: Bytes to be sent are stored in a transmit buffer, which is emptied by the "Data register empty" interrupt. 
+ *       Therefore, sending does not block the measurement (unless the buffer is full). 
+ *
  * Note: For reference use: http://www.mikrocontroller.net/articles/AVR-GCC-Tutorial/Der_UART 
  *       or the datasheet starting at page 171
  *
@@ -17,13 +20,26 @@
 #include <avr/delay.h>
 
 #include "serial.h"
-#include "pixhawk.h"
+#include "buffer.h"
 
 
 /************************************************************************/
 /* V A R I A B L E S                                                    */
 /************************************************************************/
 
+//Note: The ATmega168 has 1KB of RAM. Long messages are produced while they are sent (see serial_tx_free()), 
+//      the requests of the Pixhawk are short and parsed in every loop => small buffers are sufficient. 
+//      RX_BUFFER_SIZE holds two requests (about 4ms at 38400 baud), this is enough as long as no handler waits: 
+//      the answers are produced while they are sent, the calibration of the servo runs in the measure_handler() 
+//      and stopped LIDAR measurements are dropped as soon as they are finished 
+#define TX_BUFFER_SIZE 64		//Size of the transmit buffer [bytes] (power of two, at most 128, pixhawk.c needs 44 for 
+								//the longest answer that is sent at once) 
+#define RX_BUFFER_SIZE 16		//Size of the receive buffer [bytes] (power of two, at most 128) 
+
+BUFFER_DEFINE(tx_buffer, uint8_t, TX_BUFFER_SIZE);	//Bytes waiting to be sent (tx_buffer_add(), tx_buffer_get(), ...) 
+BUFFER_DEFINE(rx_buffer, uint8_t, RX_BUFFER_SIZE);	//Received bytes waiting to be parsed 
+
+static volatile bool tx_pending = false;	//true, if a byte was written to UDR0 since the last serial_flush() 
 
 
 
@@ -35,6 +51,12 @@
 /* @brief Flush the receive buffer (only for error-states) */
 void flush(void); 
 
+/* @brief Calculate the UBRR value and the speed mode for a baudrate */
+int16_t setup(uint32_t baud, uint16_t *ubrr, bool *u2x); 
+
+/* @brief Write a byte to the data register */
+void transmit(uint8_t data); 
+
 
 
 
@@ -47,21 +69,19 @@ void flush(void);
 /**
  * Init the use of the serial interface (USART)
  *
- * @return true, if initialization was successful  
+ * @param baud: Baudrate (e.g. one of the SERIAL_BAUD_ profiles) 
+ * @return true, if initialization was successful (false, if the baudrate can not be reached with F_CPU)  
  */
-bool serial_init(unsigned int baud) {
-	
-	//Use "Asynchronous double speed mode U2X0 = 1) 
-	//UCSR0A |= (1<<U2X0); double speed mode 
-	UCSR0A &= ~(1<<U2X0); //normal speed mode 
+bool serial_init(uint32_t baud) {
 	
-
-	//Calculate the baudrate
-	unsigned int ubrr = (double)(F_CPU/16/baud-1);  //Note change 16 to 8 for double speed mode 
+	//Set the baudrate 
+	if(!serial_set_baud(baud)) {
+		return false; 
+	}
 	
-	//Set baudrate 
-	UBRR0H = (unsigned char)(ubrr>>8); 
-	UBRR0L = (unsigned char)ubrr; 
+	//Nothing to be sent or parsed yet 
+	tx_buffer_init(); 
+	rx_buffer_init(); 
 	
 	//Enable receiver and transmitter
 	UCSR0B = (1<<RXEN0)|(1<<TXEN0); 
@@ -81,18 +101,142 @@ bool serial_init(unsigned int baud) {
 }
 
 
+/**
+ * Set the baudrate. Normal or double speed mode (U2X0) is chosen, such that the error is minimal. 
+ * Note: All bytes in the transmit buffer are sent with the old baudrate first 
+ *
+ * @param baud: Baudrate (e.g. one of the SERIAL_BAUD_ profiles) 
+ * @return true, if the baudrate is set, false if its error is larger than SERIAL_BAUD_TOLERANCE 
+ */
+bool serial_set_baud(uint32_t baud) {
+	
+	uint16_t ubrr; 
+	bool u2x; 
+	int16_t error = setup(baud, &ubrr, &u2x); 
+	
+	if(error > SERIAL_BAUD_TOLERANCE || error < -SERIAL_BAUD_TOLERANCE) {
+		//The receiver would not be able to read our frames 
+		
+		return false; 
+	}
+	
+	//Do not change the baudrate while sending 
+	serial_flush(); 
+	
+	if(u2x) {
+		UCSR0A |= (1<<U2X0);	//double speed mode 
+	} else {
+		UCSR0A &= ~(1<<U2X0);	//normal speed mode 
+	}
+	
+	UBRR0H = (uint8_t)(ubrr>>8); 
+	UBRR0L = (uint8_t)ubrr; 
+	
+	return true; 
+}
+
+
+/**
+ * Get the error of a baudrate, which results from the integer UBRR value 
+ *
+ * @param baud: Baudrate 
+ * @return Error of the baudrate [0.1%] (positive if the real baudrate is too fast) 
+ */
+int16_t serial_baud_error(uint32_t baud) {
+	
+	uint16_t ubrr; 
+	bool u2x; 
+	
+	return setup(baud, &ubrr, &u2x); 
+}
+
+
+/**
+ * Wait until all bytes in the transmit buffer are sent (including the last stop bit) 
+ */
+void serial_flush(void) {
+	
+	if(!(UCSR0B & (1<<TXEN0))) {
+		//The transmitter is not enabled yet 
+		
+		return; 
+	}
+	
+	//Wait until the buffer is empty (the interrupt is disabled after the last byte) 
+	while(UCSR0B & (1<<UDRIE0)) {
+		
+		if(!(SREG & (1<<SREG_I))) {
+			//Interrupts are disabled => send the bytes ourselves 
+			
+			uint8_t byte; 
+			
+			while (!(UCSR0A & (1<<UDRE0))); 
+			
+			if(tx_buffer_get(&byte)) {
+				transmit(byte); 
+			} else {
+				UCSR0B &= ~(1<<UDRIE0); 
+			}
+		}
+	}
+	
+	if(tx_pending) {
+		//Wait until the last byte left the shift register 
+		
+		while(!(UCSR0A & (1<<TXC0))); 
+		tx_pending = false; 
+	}
+}
+
+
 /**
  * Send a data byte
+ * Note: The byte is only stored in the transmit buffer, it is sent in the background. 
+ *       If the buffer is full, we wait until there is space again. 
  *
  * @param data: byte to be sent 
  */
 void serial_send_byte(uint8_t data) {
 	
-	//Wait for empty transmit buffer 
-	while (!(UCSR0A & (1<<UDRE0))); 
+	while(!tx_buffer_add(&data)) {
+		//The transmit buffer is full 
+		
+		if(!(SREG & (1<<SREG_I))) {
+			//Interrupts are disabled => the buffer is never emptied by the interrupt, send a byte ourselves 
+			
+			uint8_t byte; 
+			
+			while (!(UCSR0A & (1<<UDRE0))); 
+			tx_buffer_get(&byte); 
+			transmit(byte); 
+		}
+	}
 	
-	//Put data into the buffer and send it 
-	UDR0 = data; 
+	//Enable the "Data register empty" interrupt => the buffer is sent 
+	UCSR0B |= (1<<UDRIE0); 
+}
+
+/**
+ * Get the free space in the transmit buffer 
+ * Note: Long messages are produced piece by piece, as far as there is space => the sender never waits 
+ *
+ * @return Number of bytes that can be passed to serial_send_byte() without waiting 
+ */
+uint8_t serial_tx_free(void) {
+	
+	return tx_buffer_free(); 
+}
+
+
+/**
+ * Check if bytes are waiting to be sent 
+ * Note: The last byte(s) may still be in the data and the shift register (see serial_flush()) 
+ *
+ * @return true, while the transmit buffer is not empty 
+ */
+bool serial_tx_busy(void) {
+	
+	return tx_buffer_size() > 0; 
 }
 
 void serial_send_string(char buf[]) {
@@ -118,16 +262,19 @@ void serial_send_string(char buf[]) {
 
 /**
  * Receive Data 
+ * Note: The bytes are read from the receive buffer, which is filled by the "Receive complete" interrupt 
  *
- * @return received data byte 
+ * @param data: Array with space for n bytes 
+ * @param n: Maximum number of bytes to be read 
+ * @return Number of bytes read (0, if nothing was received) 
  */
-uint8_t serial_receive_byte(void) {
+uint8_t serial_receive(uint8_t *data, uint8_t n) {
 	
-	//Wait for data to be reveived 
-	while(!(UCSR0A & (1<<RXEN0))); 
+	//Copy the bytes first, then release them all at once 
+	n = rx_buffer_peek_n(data, n); 
+	rx_buffer_pop_n(n); 
 	
-	//Get and return the received data from the buffer 
-	return UDR0; 
+	return n; 
 }
 
 
@@ -136,6 +283,28 @@ uint8_t serial_receive_byte(void) {
 /* I N T E R R U P T    H A N D L E R S                                 */
 /************************************************************************/
 
+/** 
+ * Interrupt for an empty data register. 
+ * This interrupt occurs, as soon as the next byte can be sent. It is only enabled, while the transmit buffer is not empty. 
+ */
+ISR(USART_UDRE_vect) {
+	
+	uint8_t data; 
+	
+	if(tx_buffer_get(&data)) {
+		//Send the next byte (written here instead of calling transmit(), this runs for every byte) 
+		
+		UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0); 
+		tx_pending = true; 
+		UDR0 = data; 
+	} else {
+		//Everything is sent => disable the interrupt until new data is available 
+		
+		UCSR0B &= ~(1<<UDRIE0); 
+	}
+}
+
+
 /** 
  * Interrupt for complete reception. 
  * This interrupt occurs, as soon as a character was successfully read. 
@@ -145,8 +314,9 @@ ISR(USART_RX_vect) {
 	//Store data locally 
 	uint8_t data = UDR0; 
 	
-	//Notify the Pixhawk-Module that new data is available 
-	pixhawk_parse(data);
+	//Store the data, it is parsed in the main loop by the Pixhawk-Module 
+	//Note: If the buffer is full, the byte is lost (the parser will wait for the next Start-Character) 
+	rx_buffer_add(&data); 
 	
 }
 
@@ -156,6 +326,61 @@ ISR(USART_RX_vect) {
 /* P R I V A T E    F U N C T I O N S                                   */
 /************************************************************************/
 
+/**
+ * Calculate the register values for a baudrate 
+ * Note: The values are calculated for both speed modes, the one with the smaller error is chosen 
+ *       (normal speed mode if both are equal, as the receiver samples more often) 
+ *
+ * @param baud: Baudrate 
+ * @param ubrr: Pointer where the value for the UBRR0 register is stored 
+ * @param u2x: Pointer where the speed mode is stored (true == double speed mode) 
+ * @return Error of the baudrate [0.1%] 
+ */
+int16_t setup(uint32_t baud, uint16_t *ubrr, bool *u2x) {
+	
+	int16_t best = INT16_MAX; 
+	
+	//Normal speed mode divides the clock by 16, double speed mode by 8 
+	for(uint8_t div = 16; div >= 8; div = div/2) {
+		
+		//UBRR = F_CPU/(div*baud) - 1, rounded to the nearest integer 
+		uint32_t value = (F_CPU + div*baud/2)/(div*baud); 
+		
+		if(value < 1 || value > 4096) {
+			//The UBRR0 register has 12 bits 
+			
+			continue; 
+		}
+		
+		//Real baudrate compared to the requested one 
+		int32_t real = F_CPU/(div*value); 
+		int16_t error = (int16_t)((real - (int32_t)baud)*1000/(int32_t)baud); 
+		
+		if((error < 0 ? -error : error) < (best < 0 ? -best : best)) {
+			best = error; 
+			*ubrr = value - 1; 
+			*u2x = (div == 8); 
+		}
+	}
+	
+	return best; 
+}
+
+
+/**
+ * Write a byte to the data register, it is sent immediately 
+ * Note: The "Transmit complete" flag is cleared (by writing a one), such that serial_flush() can wait for it 
+ *
+ * @param data: byte to be sent 
+ */
+void transmit(uint8_t data) {
+	
+	UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0); 
+	tx_pending = true; 
+	UDR0 = data; 
+}
+
+
 /** 
  * Flush the receive buffer 
  *
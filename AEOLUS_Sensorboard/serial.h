@@ -9,13 +9,46 @@
 #ifndef SERIAL_H_
 #define SERIAL_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** Baudrate Profiles [baud] 
+ *  Note: The comments give the error at F_CPU = 8MHz (115200 is not supported: -3.5% error) */
+#define SERIAL_BAUD_38400   38400L		//+0.2% 
+#define SERIAL_BAUD_76800   76800L		//+0.2% 
+#define SERIAL_BAUD_250000  250000L		//exact 
+#define SERIAL_BAUD_500000  500000L		//exact 
+
+/** Maximum error of a baudrate [0.1%] */
+#define SERIAL_BAUD_TOLERANCE 20
+
+
 /* @brief Initialize the use of the serial communication */ 
-bool serial_init(unsigned int baud); 
+bool serial_init(uint32_t baud); 
+
+/* @brief Change the baudrate */ 
+bool serial_set_baud(uint32_t baud); 
+
+/* @brief Return the error of a baudrate [0.1%] */ 
+int16_t serial_baud_error(uint32_t baud); 
+
+/* @brief Wait until all data is sent */ 
+void serial_flush(void); 
 
 /* @brief Send a byte using the serial interface */ 
 void serial_send_byte(uint8_t data);
 
+/* @brief Return the number of bytes that can be sent without waiting */ 
+uint8_t serial_tx_free(void); 
+
+/* @brief Return true, while bytes are waiting in the transmit buffer */ 
+bool serial_tx_busy(void); 
+
 /* @brief Send a string using the serial interface */
 void serial_send_string(char buf[]); 
 
+/* @brief Read up to n received bytes */
+uint8_t serial_receive(uint8_t *data, uint8_t n); 
+
 #endif /* SERIAL_H_ */
\ No newline at end of file
@@ -10,27 +10,122 @@
  */ 
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include "config.h"
 #include "servo.h"
+#include "timer.h"
 
 #define ServoRange 180   //Number of Degrees from fully left to fully right []
-#define ServoSpeed 2    //Speed of the Servo [ms/]
+#define ServoSpeed 5    //Speed of the Servo [ms/] (used as long as the servo is not calibrated) 
+#define ServoSettle 10  //Time for starting and stopping [ms] (used as long as the servo is not calibrated) 
 
 
 #define minPWM 575	//575 (650 was ok) 
 #define maxPWM 2350 	//without LIDAR: 2348, with LIDAR: 2375
 
+#define TOP 19999		//Maximum Timer-Count => 20ms period at F_CPU/8 
+#define PERIOD 20000L	//Period of the PWM [us] 
+
+#if PERIOD != TOP+1
+	#error "Timer1 must count microseconds (the start of the sweep is taken from its counter)"
+#endif
+
+#define MIN_SWEEP_SPEED 10	//Slowest sweep [/s] (the angle calculation overflows for slower sweeps) 
+
+
+//PWM LOOKUP TABLE 
+//The compare values for every degree are calculated by the preprocessor => no float math at runtime 
+#if ServoRange != 180
+	#error "The PWM lookup table has 181 entries, adapt it to the new ServoRange"
+#endif
+
+#define PWM(deg) (TOP - (minPWM + ((uint32_t)(maxPWM-minPWM)*(deg) + ServoRange/2)/ServoRange))
+#define PWM_10(deg) PWM(deg), PWM(deg+1), PWM(deg+2), PWM(deg+3), PWM(deg+4), \
+					PWM(deg+5), PWM(deg+6), PWM(deg+7), PWM(deg+8), PWM(deg+9)
+
+//Value of OCR1A for each degree (0..ServoRange) 
+static const uint16_t pwm_table[ServoRange+1] PROGMEM = {
+	PWM_10(0),   PWM_10(10),  PWM_10(20),  PWM_10(30),  PWM_10(40),  PWM_10(50), 
+	PWM_10(60),  PWM_10(70),  PWM_10(80),  PWM_10(90),  PWM_10(100), PWM_10(110), 
+	PWM_10(120), PWM_10(130), PWM_10(140), PWM_10(150), PWM_10(160), PWM_10(170), 
+	PWM(180)
+};
+
+
+//MOTION MODEL 
+//Travel time of the servo = base + per_deg*(angle difference)/SERVO_MODEL_SCALE 
+#define MODEL_MAGIC 0x5E70	//Marks a valid model in the EEPROM 
+
+typedef struct {
+	uint16_t magic;			//MODEL_MAGIC, if the model was calibrated 
+	uint16_t base;			//Time for starting and stopping [ms] 
+	uint16_t per_deg;		//Time per degree [ms/SERVO_MODEL_SCALE] 
+} servo_model; 
+
+static servo_model EEMEM stored_model;	//Calibrated model, kept over a reset 
+
+
 static struct {
-	uint16_t angle; 
+	uint16_t angle;		//Commanded angle [1/ANGLE_RES ] 
+	uint32_t arrival;	//Time the servo reaches the angle [ms] 
+	servo_model model;	//Motion model used to calculate the travel time 
 } state = {
-	.angle = 0
+	.angle = 0,
+	.arrival = 0,
+	.model = {0, ServoSettle, ServoSpeed*SERVO_MODEL_SCALE}
+};
+
+
+//CONTINUOUS SWEEP 
+//The commanded angle is a triangle wave between from and from+span. One way takes a whole number of PWM periods, 
+//the interrupt advances the angle by a fixed step per period (the remainder of span/periods is distributed like 
+//in a Bresenham line) => no multiplications or divisions in the interrupt. 
+//The same angle is calculated from the time for the measurements (see sweep_angle()). 
+//Note: The start is moved forward by one period of the triangle after every period (by the interrupt), 
+//      the time differences would overflow after 2^31us otherwise 
+static struct {
+	volatile bool active;	//true, while the servo sweeps 
+	volatile bool moving;	//true, as soon as the servo reached the start angle and sweeps 
+	uint16_t from;			//Start angle of the sweep [1/ANGLE_RES ] 
+	uint16_t span;			//Angle between start and end of the sweep [1/ANGLE_RES ] 
+	uint32_t half;			//Time for one way of the sweep [us] (periods*PERIOD) 
+	volatile uint32_t start;	//Time the current period of the sweep started (at an overflow of Timer1) [us] 
+	uint32_t lag;			//Time the servo is behind the commanded angle [us] 
+	
+	uint16_t periods;		//Number of PWM periods for one way 
+	uint16_t step;			//Angle the servo advances per PWM period (span/periods) [1/ANGLE_RES ] 
+	uint16_t step_rest;		//Remainder of the step (span%periods) 
+	uint16_t rest;			//Accumulated remainder, the angle advances by one more as soon as it reaches periods 
+	uint16_t count;			//PWM periods since the start of the current period of the sweep 
+	uint16_t wait;			//PWM periods until the servo reached the start angle 
+	uint16_t angle;			//Commanded angle [1/ANGLE_RES ] 
+} sweep = {
+	.active = false
 };
 
 
-/* @brief Wait for a given amount of Milliseconds */ 
-void wait(uint16_t time);
+/* @brief Commanded angle of the sweep at a given time */ 
+uint16_t sweep_angle(uint32_t time); 
+
+/* @brief Compare value for a given angle */ 
+uint16_t pwm(uint16_t angle); 
+
+
+//POSITION FEEDBACK 
+//The ADC converts the voltage of the potentiometer continuously, the interrupt filters the values 
+#if SERVO_FEEDBACK == 1
+
+static volatile uint16_t feedback = 0;	//Filtered ADC value (4 times the ADC value) 
+
+#endif
+
+/* @brief Convert an ADC value of the potentiometer to an angle */ 
+uint16_t feedback2angle(uint16_t adc); 
 
 
 
@@ -51,7 +146,7 @@ bool servo_init(void) {
 	
 	//Set maximum Timer-Count 
 	// ICR1 = F_CPU/(Servo acceptable Value in Hz); 
-	ICR1 = 19999; 
+	ICR1 = TOP; 
 
 	//Init the Servo and make sure it starts in middle Position 
 	//OCR1A = ICR1 - (maxPWM-minPWM)/2 + minPWM; 
@@ -74,6 +169,31 @@ bool servo_init(void) {
 	OCR1A = ICR1 - maxPWM; */
 	
 	state.angle = 0; 
+	state.arrival = timer_get_ms(); 
+	
+	#if SERVO_FEEDBACK == 1
+	
+		//The potentiometer is connected to an input without pull-up (port_init() sets all pins as outputs) 
+		DDRC &= ~(1<<FEEDBACK_CHANNEL); 
+		PORTC &= ~(1<<FEEDBACK_CHANNEL); 
+		DIDR0 |= (1<<FEEDBACK_CHANNEL);		//Disable the digital input buffer 
+		
+		//Reference is AVcc, select the channel 
+		ADMUX = (1<<REFS0) | FEEDBACK_CHANNEL; 
+		ADCSRB = 0x00;	//Free running mode 
+		
+		//Enable the ADC with a prescaler of 128 (62.5kHz at 8MHz) and start the conversions 
+		ADCSRA = (1<<ADEN) | (1<<ADSC) | (1<<ADATE) | (1<<ADIE) | (1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0); 
+	
+	#endif
+	
+	//Load the calibrated motion model, if there is one 
+	servo_model model; 
+	eeprom_read_block(&model, &stored_model, sizeof(servo_model)); 
+	
+	if(model.magic == MODEL_MAGIC) {
+		state.model = model; 
+	}
 	
 	return true; 
 }
@@ -81,48 +201,416 @@ bool servo_init(void) {
 
 
 /**
- * Set the Servo to a given angle
+ * Set the Servo to a given angle. The function returns immediately, use servo_is_settled() 
+ * to check if the servo reached the new position. 
  * 
- * @param deg: angle in degrees the servo should move to 
+ * @param angle: angle the servo should move to [1/ANGLE_RES ] 
+ * @return time the servo needs to reach the new position [ms] 
  */
-void servo_set(float deg) {
+uint16_t servo_set(uint16_t angle) {
     
-	//Calculate the PWM Signal 
-	uint16_t pwm = (((float)((float)maxPWM-(float)minPWM))/(float)ServoRange*deg + (float)minPWM);
+	//A single move ends the sweep 
+	servo_sweep_stop(); 
+	
+	//Saturate the angle => the PWM output stays between minPWM and maxPWM 
+	if(angle > DEG(ServoRange)) {
+		angle = DEG(ServoRange); 
+	}
 	
 	//Time for moving to this position 
-	int16_t ang_diff = state.angle-deg; 
+	int16_t ang_diff = state.angle-angle; 
 	if(ang_diff < 0) {
 		ang_diff = -ang_diff; 
 	}
-	uint16_t time = (float)ang_diff*(float)ServoSpeed;	
+	uint16_t time = 0; 
+	if(ang_diff > 0) {
+		time = state.model.base + ((uint32_t)state.model.per_deg*ang_diff)/(SERVO_MODEL_SCALE*ANGLE_RES); 
+	}
+	
+	//Store the angle and the expected time of arrival locally
+	state.angle = angle;
+	state.arrival = timer_get_ms() + time; 
+	
+	//Set the PWM Signal 
+	OCR1A = pwm(angle); 
+	
+	//OCR1A = ICR1 - deg; 
+	
+	return time; 
+}
+
+
+
+/**
+ * Check if the servo reached the angle of the last servo_set() 
+ * With SERVO_FEEDBACK the measured position is compared with the angle. If the servo does not reach the 
+ * tolerance, it is considered settled FEEDBACK_TIMEOUT after the modeled time of arrival. 
+ *
+ * @return true, if the servo reached the angle (or the travel time of the last move has passed) 
+ */
+bool servo_is_settled(void) {
+	
+	#if SERVO_FEEDBACK == 1
 	
-	//Store the angle locally
-	state.angle = deg;
+		int16_t diff = servo_get_position() - state.angle; 
+		
+		if(diff <= FEEDBACK_TOLERANCE && diff >= -FEEDBACK_TOLERANCE) {
+			return true; 
+		}
+		
+		return (int32_t)(timer_get_ms() - state.arrival) >= FEEDBACK_TIMEOUT; 
 	
-	//Saturate PWM output
-	if(pwm<minPWM) {
-		pwm = minPWM; 
+	#else
+	
+		return (int32_t)(timer_get_ms() - state.arrival) >= 0; 
+	
+	#endif
+}
+
+
+
+/**
+ * Get the current position of the servo 
+ * With SERVO_FEEDBACK the position is measured by the ADC, otherwise it is taken from the motion model. 
+ *
+ * @return position of the servo [1/ANGLE_RES ] 
+ */
+uint16_t servo_get_position(void) {
+	
+	#if SERVO_FEEDBACK == 1
+	
+		uint16_t adc; 
+		
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			adc = feedback; 
+		}
+		
+		return feedback2angle(adc >> 2); 
+	
+	#else
+	
+		return servo_get_angle_at(timer_get_us()); 
+	
+	#endif
+}
+
+
+
+/**
+ * Check if the motion model was calibrated. Otherwise the travel time is estimated using ServoSettle and ServoSpeed 
+ *
+ * @return true, if a calibrated model was loaded from the EEPROM 
+ */
+bool servo_model_valid(void) {
+	
+	return state.model.magic == MODEL_MAGIC; 
+}
+
+
+
+/**
+ * Set the motion model of the servo and store it in the EEPROM 
+ * Travel time = base + per_deg*(angle difference)/SERVO_MODEL_SCALE 
+ *
+ * @param base: time the servo needs for starting and stopping [ms] 
+ * @param per_deg: time the servo needs per degree [ms/SERVO_MODEL_SCALE] 
+ */
+void servo_set_model(uint16_t base, uint16_t per_deg) {
+	
+	state.model.magic = MODEL_MAGIC; 
+	state.model.base = base; 
+	state.model.per_deg = per_deg; 
+	
+	eeprom_update_block(&state.model, &stored_model, sizeof(servo_model)); 
+}
+
+
+
+/**
+ * Start a continuous sweep. The servo moves at constant speed from one angle to the other and back, 
+ * without stopping. The PWM is updated by the overflow interrupt of Timer1 (every 20ms). 
+ * Note: The speed is limited to the speed of the motion model 
+ * 
+ * @param from: start angle of the sweep [1/ANGLE_RES ] 
+ * @param to: end angle of the sweep [1/ANGLE_RES ] 
+ * @param speed: speed of the sweep [/s] (at least MIN_SWEEP_SPEED) 
+ * @return true, if the sweep was started 
+ */
+bool servo_sweep_start(uint16_t from, uint16_t to, uint16_t speed) {
+	
+	if(to > DEG(ServoRange) || from >= to || speed < MIN_SWEEP_SPEED) {
+		return false; 
 	}
 	
-	if(pwm>maxPWM) {
-		pwm = maxPWM;
+	servo_sweep_stop(); 
+	
+	//The servo can not move faster than the motion model allows 
+	uint16_t max_speed = 1000L*SERVO_MODEL_SCALE/state.model.per_deg; 
+	
+	if(speed > max_speed) {
+		speed = max_speed; 
 	}
 	
-	OCR1A = ICR1 - pwm; 
+	//Move to the start angle first 
+	uint16_t time = servo_set(from); 
 	
-	//Wait for the servo to reach the new position 
-	wait(time); 
+	sweep.from = from; 
+	sweep.span = to - from; 
 	
-	//OCR1A = ICR1 - deg; 
+	//One way takes a whole number of PWM periods (at least one) 
+	sweep.periods = ((uint32_t)sweep.span*(1000000L/ANGLE_RES)/speed + PERIOD/2)/PERIOD; 
+	
+	if(sweep.periods == 0) {
+		sweep.periods = 1; 
+	}
+	
+	sweep.half = (uint32_t)sweep.periods*PERIOD; 
+	sweep.step = sweep.span/sweep.periods; 
+	sweep.step_rest = sweep.span%sweep.periods; 
+	sweep.rest = sweep.periods/2;		//The angle is rounded 
+	sweep.count = 0; 
+	sweep.angle = from; 
+	sweep.wait = ((uint32_t)time*1000 + PERIOD - 1)/PERIOD; 
+	sweep.moving = false; 
+	
+	//The PWM is held for one period (on average half a period too late) and the servo needs time to follow 
+	sweep.lag = PERIOD/2 + (uint32_t)state.model.base*1000; 
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		
+		uint32_t now = timer_get_us(); 
+		
+		TIFR1 = (1<<TOV1); 
+		uint16_t count = TCNT1; 
+		
+		if(TIFR1 & (1<<TOV1)) {
+			//The timer overflowed just now => ignore this overflow 
+			
+			TIFR1 = (1<<TOV1); 
+			count = TCNT1; 
+		}
+		
+		//The sweep starts at the overflow after the servo reached the start angle 
+		sweep.start = now + (TOP + 1 - count) + (uint32_t)sweep.wait*PERIOD; 
+		sweep.active = true; 
+		
+		//Allow overflow interrupts => the PWM is updated every period 
+		TIMSK1 |= (1<<TOIE1); 
+	}
+	
+	return true; 
+}
+
+
+
+/**
+ * Stop the continuous sweep. The servo stays at its current angle. 
+ */
+void servo_sweep_stop(void) {
+	
+	if(!sweep.active) {
+		return; 
+	}
+	
+	TIMSK1 &= ~(1<<TOIE1); 
+	sweep.active = false; 
+	
+	//The servo stops where it is commanded to 
+	state.angle = sweep.angle; 
+	state.arrival = timer_get_ms() + sweep.lag/1000; 
+}
+
+
+
+/**
+ * Get the angle of the servo at a given time during the sweep. The angle is calculated from the commanded 
+ * angle and the lag of the servo => use the mid-time of a measurement to get its bearing. 
+ *
+ * @param time: time of interest (see timer_get_us()) [us] 
+ * @return angle of the servo at the given time [1/ANGLE_RES ] (angle of the last servo_set(), if the servo does not sweep) 
+ */
+uint16_t servo_get_angle_at(uint32_t time) {
+	
+	if(!sweep.active) {
+		return state.angle; 
+	}
+	
+	return sweep_angle(time - sweep.lag); 
+}
+
+
+
+
+
+/************************************************************************/
+/* P R I V A T E     F U N C T I O N S                                  */
+/************************************************************************/
+
+/**
+ * Calculate the commanded angle of the sweep at a given time 
+ *
+ * Note: The time is calculated in steps of 16us, otherwise the multiplication overflows for slow sweeps 
+ *
+ * @param time: time of interest [us] 
+ * @return commanded angle [1/ANGLE_RES ] 
+ */
+uint16_t sweep_angle(uint32_t time) {
+	
+	uint32_t start; 
+	bool moving; 
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		start = sweep.start; 
+		moving = sweep.moving; 
+	}
+	
+	int32_t elapsed = time - start; 
+	
+	while(elapsed < 0) {
+		
+		if(!moving) {
+			//The servo is still moving to the start angle 
+			
+			return sweep.from; 
+		}
+		
+		//The time is in an earlier period of the sweep 
+		elapsed += 2*sweep.half; 
+	}
+	
+	uint32_t half = sweep.half >> 4; 
+	uint32_t phase = ((uint32_t)elapsed >> 4) % (2*half); 
+	
+	if(phase < half) {
+		//Moving from the start to the end 
+		
+		return sweep.from + (sweep.span*phase + half/2)/half; 
+	} 
+	
+	//Moving back 
+	return sweep.from + sweep.span - (sweep.span*(phase - half) + half/2)/half; 
 }
 
 
+/**
+ * Calculate the compare value for a given angle 
+ * The value is interpolated linearly between the entries of the lookup table (one entry per degree) 
+ *
+ * @param angle: angle of the servo [1/ANGLE_RES ] (0..DEG(ServoRange)) 
+ * @return value for OCR1A 
+ */
+uint16_t pwm(uint16_t angle) {
+	
+	uint8_t deg = angle/ANGLE_RES; 
+	uint8_t frac = angle%ANGLE_RES; 
+	
+	uint16_t value = pgm_read_word(&pwm_table[deg]); 
+	
+	if(frac > 0) {
+		//The compare value decreases with the angle 
+		
+		uint16_t next = pgm_read_word(&pwm_table[deg+1]); 
+		value -= ((value - next)*frac + ANGLE_RES/2)/ANGLE_RES; 
+	}
+	
+	return value; 
+}
+
+
+/**
+ * Convert an ADC value of the potentiometer to an angle 
+ * The potentiometer is assumed to be linear between FEEDBACK_MIN (0) and FEEDBACK_MAX (ServoRange) 
+ *
+ * @param adc: ADC value 
+ * @return angle of the servo [1/ANGLE_RES ] (0..DEG(ServoRange)) 
+ */
+uint16_t feedback2angle(uint16_t adc) {
+	
+	if(adc <= FEEDBACK_MIN) {
+		return 0; 
+	}
+	
+	if(adc >= FEEDBACK_MAX) {
+		return DEG(ServoRange); 
+	}
+	
+	return ((uint32_t)(adc - FEEDBACK_MIN)*DEG(ServoRange) + (FEEDBACK_MAX-FEEDBACK_MIN)/2)/(FEEDBACK_MAX-FEEDBACK_MIN); 
+}
+
+
+
 
 
+/************************************************************************/
+/* I N T E R R U P T    H A N D L E R S                                 */
+/************************************************************************/
 
-void wait(uint16_t time) {
-	for(uint16_t i=0; i<time; i++) {
-		_delay_ms(1); 
+/**
+ * Overflow Interrupt of Timer1 
+ * This interrupt occurs at the end of every PWM period (20ms). The new compare value is taken over at 
+ * the start of the next period. 
+ * The sweep advances by the precalculated step, the interrupt does not use the time (no 32bit divisions). 
+ * Note: Other interrupts are allowed during pwm() (e.g. the USART at high baudrates) 
+ */
+ISR(TIMER1_OVF_vect, ISR_NOBLOCK) {
+	
+	if(!sweep.active) {
+		return; 
+	}
+	
+	if(!sweep.moving) {
+		
+		if(sweep.wait > 0) {
+			//The servo is still moving to the start angle 
+			
+			sweep.wait--; 
+			return; 
+		}
+		
+		//The servo reached the start angle => the sweep starts with this period 
+		sweep.moving = true; 
+		return; 
+	}
+	
+	uint16_t delta = sweep.step; 
+	sweep.rest += sweep.step_rest; 
+	
+	if(sweep.rest >= sweep.periods) {
+		sweep.rest -= sweep.periods; 
+		delta++; 
+	}
+	
+	sweep.count++; 
+	
+	if(sweep.count <= sweep.periods) {
+		//Moving from the start to the end 
+		
+		sweep.angle += delta; 
+	} else {
+		//Moving back 
+		
+		sweep.angle -= delta; 
 	}
-}
\ No newline at end of file
+	
+	if(sweep.count == 2*sweep.periods) {
+		//The servo is back at the start angle => the next period of the sweep starts 
+		
+		sweep.count = 0; 
+		sweep.start += 2*sweep.half; 
+	}
+	
+	OCR1A = pwm(sweep.angle); 
+}
+
+
+
+#if SERVO_FEEDBACK == 1
+/**
+ * Conversion Complete Interrupt of the ADC 
+ * The ADC runs in free running mode, the values are filtered by a moving average (weight 1/4) 
+ */
+ISR(ADC_vect) {
+	
+	feedback = feedback - (feedback >> 2) + ADC; 
+}
+#endif
\ No newline at end of file
@@ -10,14 +10,40 @@
 #define SERVO_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+
+/** Scale of the time per degree in the motion model (per_deg is given in 1/16 ms) */ 
+#define SERVO_MODEL_SCALE 16
 
 
 /* @brief Init the use of a Servo */ 
 bool servo_init(void);
 
 
-/* @brief Set the servo to a given angle in Degrees */
-void servo_set(float deg); 
+/* @brief Set the servo to a given angle [1/ANGLE_RES ] without waiting, return the time it needs */
+uint16_t servo_set(uint16_t angle); 
+
+/* @brief Return true, as soon as the servo reached the angle of the last servo_set() */
+bool servo_is_settled(void); 
+
+/* @brief Return true, if the motion model of the servo was calibrated */
+bool servo_model_valid(void); 
+
+/* @brief Set the motion model of the servo and store it in the EEPROM */
+void servo_set_model(uint16_t base, uint16_t per_deg); 
+
+/* @brief Start a continuous sweep of the servo at a constant speed */
+bool servo_sweep_start(uint16_t from, uint16_t to, uint16_t speed); 
+
+/* @brief Stop the continuous sweep */
+void servo_sweep_stop(void); 
+
+/* @brief Return the angle of the servo at a given time (see timer_get_us()) */
+uint16_t servo_get_angle_at(uint32_t time); 
+
+/* @brief Return the current position of the servo (measured, if SERVO_FEEDBACK is used) */
+uint16_t servo_get_position(void); 
 
 
 
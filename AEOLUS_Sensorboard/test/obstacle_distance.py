@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# obstacle_distance.py
+#
+# Generates obstacle_distance_vector.h, the expected MAVLink v2 OBSTACLE_DISTANCE frame of send_mavlink()
+# for a fixed small Matrix. The frame is packed by pymavlink, if it is installed (pip install pymavlink),
+# otherwise by the reference encoder below (the header records which one was used).
+#
+# Usage: python3 obstacle_distance.py > obstacle_distance_vector.h
+#
+
+import math
+import struct
+import sys
+from fractions import Fraction
+
+#Values of config.h
+ANGLE_RES = 10
+INTERVAL = 2*ANGLE_RES
+RANGE = 90
+LIDAR_MAX_DISTANCE = 700
+MAVLINK_SYSTEM_ID = 1
+MAVLINK_COMPONENT_ID = 196
+
+#Values of pixhawk.c
+MAV_BINS = 72
+MAV_INCREMENT = 2*RANGE*ANGLE_RES//MAV_BINS
+MAV_MIN_DISTANCE = 5
+MAV_UNKNOWN = 0xFFFF
+MAV_LASER = 0
+MAV_FRAME_BODY_FRD = 12
+
+#OBSTACLE_DISTANCE (id 330)
+MSG_ID = 330
+CRC_EXTRA = 23
+
+#Input of the test
+TIME_MS = 123456
+SEQ = 42
+CELLS = 2*RANGE*ANGLE_RES//INTERVAL
+
+
+def cell(ind):
+	"""Distance stored in the small Matrix: some cells are not measured, some see nothing"""
+	if ind % 17 == 5:
+		return 0
+	if ind % 23 == 7:
+		return 850
+	if ind % 11 == 3:
+		return LIDAR_MAX_DISTANCE
+	return 100 + 7*ind + 3*(ind % 5)
+
+
+#Center of the first bin [deg]
+ANGLE_OFFSET = -RANGE + MAV_INCREMENT/ANGLE_RES/2
+
+
+def bins(matrix):
+	"""Reduce the small Matrix to the bins of OBSTACLE_DISTANCE
+	Every measurement is put into the bin, whose center (ANGLE_OFFSET + b*increment) is closest to its angle in
+	the body frame (clockwise from the bow, the small Matrix starts on starboard). A measurement on the border of
+	two bins goes into the one on the port side."""
+	distances = [MAV_UNKNOWN]*MAV_BINS
+	increment = Fraction(MAV_INCREMENT, ANGLE_RES)
+	offset = Fraction(-RANGE) + increment/2
+	for ind in range(CELLS):
+		angle = Fraction(RANGE) - Fraction(ind*INTERVAL, ANGLE_RES)
+		b = math.ceil((angle - offset)/increment - Fraction(1, 2))
+		assert 0 <= b < MAV_BINS, 'measurement %d is not in a bin' % ind
+		assert abs(angle - (offset + b*increment)) <= increment/2
+		value = matrix[ind]
+		if value == 0:
+			continue
+		if value >= LIDAR_MAX_DISTANCE:
+			value = LIDAR_MAX_DISTANCE + 1
+		distances[b] = min(distances[b], value)
+	return distances
+
+
+def pack_pymavlink(fields):
+	from pymavlink.dialects.v20 import common as mavlink
+
+	mav = mavlink.MAVLink(None, srcSystem=MAVLINK_SYSTEM_ID, srcComponent=MAVLINK_COMPONENT_ID)
+	mav.seq = SEQ
+	msg = mavlink.MAVLink_obstacle_distance_message(**fields)
+	return bytes(msg.pack(mav))
+
+
+def crc_x25(data):
+	crc = 0xFFFF
+	for byte in data:
+		tmp = byte ^ (crc & 0xFF)
+		tmp = (tmp ^ (tmp << 4)) & 0xFF
+		crc = ((crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4)) & 0xFFFF
+	return crc
+
+
+def pack_reference(fields):
+	payload = struct.pack('<Q72HHHBBffB', fields['time_usec'], *fields['distances'], fields['min_distance'],
+		fields['max_distance'], fields['sensor_type'], fields['increment'], fields['increment_f'],
+		fields['angle_offset'], fields['frame'])
+	header = struct.pack('<BBBBBBHB', len(payload), 0, 0, SEQ, MAVLINK_SYSTEM_ID, MAVLINK_COMPONENT_ID,
+		MSG_ID & 0xFFFF, MSG_ID >> 16)
+	crc = crc_x25(header + payload + bytes([CRC_EXTRA]))
+	return bytes([0xFD]) + header + payload + struct.pack('<H', crc)
+
+
+def main():
+	matrix = [cell(ind) for ind in range(CELLS)]
+	fields = {
+		'time_usec': TIME_MS*1000,
+		'sensor_type': MAV_LASER,
+		'distances': bins(matrix),
+		'increment': (MAV_INCREMENT + ANGLE_RES - 1)//ANGLE_RES,
+		'min_distance': MAV_MIN_DISTANCE,
+		'max_distance': LIDAR_MAX_DISTANCE,
+		'increment_f': MAV_INCREMENT/ANGLE_RES,
+		'angle_offset': ANGLE_OFFSET,
+		'frame': MAV_FRAME_BODY_FRD,
+	}
+
+	try:
+		frame = pack_pymavlink(fields)
+		generator = 'pymavlink'
+	except ImportError:
+		frame = pack_reference(fields)
+		generator = 'reference encoder of obstacle_distance.py (pymavlink not installed)'
+
+	out = sys.stdout
+	out.write('/*\n * obstacle_distance_vector.h\n *\n')
+	out.write(' * Generated by obstacle_distance.py using %s, do not edit\n */ \n\n' % generator)
+	out.write('#define VECTOR_TIME_MS %dUL\n' % TIME_MS)
+	out.write('#define VECTOR_SEQ %d\n\n' % SEQ)
+	out.write('//Small Matrix (distance [cm] of every INTERVAL, 0 == not measured) \n')
+	out.write('static const uint16_t vector_matrix[%d] = {' % CELLS)
+	for i, value in enumerate(matrix):
+		out.write(('\n\t' if i % 12 == 0 else ' ') + '%d,' % value)
+	out.write('\n};\n\n')
+	out.write('//Expected frame \n')
+	out.write('static const uint8_t vector_frame[%d] = {' % len(frame))
+	for i, byte in enumerate(frame):
+		out.write(('\n\t' if i % 16 == 0 else ' ') + '0x%02x,' % byte)
+	out.write('\n};\n')
+
+
+if __name__ == '__main__':
+	main()
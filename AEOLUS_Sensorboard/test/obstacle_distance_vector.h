@@ -0,0 +1,36 @@
+/*
+ * obstacle_distance_vector.h
+ *
+ * Generated by obstacle_distance.py using reference encoder of obstacle_distance.py (pymavlink not installed), do not edit
+ */ 
+
+#define VECTOR_TIME_MS 123456UL
+#define VECTOR_SEQ 42
+
+//Small Matrix (distance [cm] of every INTERVAL, 0 == not measured) 
+static const uint16_t vector_matrix[90] = {
+	100, 110, 120, 700, 140, 0, 145, 850, 165, 175, 170, 180,
+	190, 200, 700, 205, 215, 225, 235, 245, 240, 250, 0, 270,
+	280, 700, 285, 295, 305, 315, 850, 320, 330, 340, 350, 345,
+	700, 365, 375, 0, 380, 390, 400, 410, 420, 415, 425, 700,
+	445, 455, 450, 460, 470, 850, 490, 485, 0, 505, 700, 525,
+	520, 530, 540, 550, 560, 555, 565, 575, 585, 700, 590, 600,
+	610, 0, 630, 625, 850, 645, 655, 665, 700, 670, 680, 690,
+	700, 695, 705, 715, 725, 735,
+};
+
+//Expected frame 
+static const uint8_t vector_frame[179] = {
+	0xfd, 0xa7, 0x00, 0x00, 0x2a, 0x01, 0xc4, 0x4a, 0x01, 0x00, 0x00, 0xca, 0x5b, 0x07, 0x00, 0x00,
+	0x00, 0x00, 0xbd, 0x02, 0xbd, 0x02, 0xbd, 0x02, 0xb7, 0x02, 0xbd, 0x02, 0xb2, 0x02, 0xa8, 0x02,
+	0x9e, 0x02, 0x99, 0x02, 0x8f, 0x02, 0x85, 0x02, 0x71, 0x02, 0x76, 0x02, 0xff, 0xff, 0x62, 0x02,
+	0x4e, 0x02, 0xbd, 0x02, 0x49, 0x02, 0x3f, 0x02, 0x2b, 0x02, 0x30, 0x02, 0x26, 0x02, 0x1c, 0x02,
+	0x08, 0x02, 0x0d, 0x02, 0xbd, 0x02, 0xf9, 0x01, 0xe5, 0x01, 0xea, 0x01, 0xbd, 0x02, 0xd6, 0x01,
+	0xc2, 0x01, 0xc7, 0x01, 0xbd, 0x01, 0xbd, 0x02, 0x9f, 0x01, 0xa4, 0x01, 0x9a, 0x01, 0x90, 0x01,
+	0x7c, 0x01, 0xff, 0xff, 0x77, 0x01, 0x6d, 0x01, 0x59, 0x01, 0x5e, 0x01, 0x54, 0x01, 0x4a, 0x01,
+	0x40, 0x01, 0x3b, 0x01, 0x31, 0x01, 0x27, 0x01, 0x1d, 0x01, 0x18, 0x01, 0x0e, 0x01, 0xff, 0xff,
+	0xf0, 0x00, 0xf5, 0x00, 0xeb, 0x00, 0xe1, 0x00, 0xcd, 0x00, 0xbd, 0x02, 0xc8, 0x00, 0xbe, 0x00,
+	0xaa, 0x00, 0xaf, 0x00, 0xa5, 0x00, 0xbd, 0x02, 0x91, 0x00, 0x8c, 0x00, 0xbd, 0x02, 0x78, 0x00,
+	0x64, 0x00, 0x05, 0x00, 0xbc, 0x02, 0x00, 0x03, 0x00, 0x00, 0x20, 0x40, 0x00, 0x80, 0xb1, 0xc2,
+	0x0c, 0x23, 0x6d,
+};
@@ -0,0 +1,15 @@
+/*
+ * Host stub of <avr/eeprom.h> (the EEPROM is ordinary memory on the host) 
+ */ 
+#include <stddef.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n) {
+	memcpy(dst, src, n); 
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n) {
+	memcpy(dst, src, n); 
+}
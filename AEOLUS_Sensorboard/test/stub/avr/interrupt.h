@@ -0,0 +1,7 @@
+/*
+ * Host stub of <avr/interrupt.h> (the tests call the handlers directly) 
+ */ 
+#define ISR_NOBLOCK
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define sei()
+#define cli()
@@ -0,0 +1,30 @@
+/*
+ * Host stub of <avr/io.h> 
+ * The registers are ordinary variables defined by the test (only the ones used by the tested modules) 
+ */ 
+#include <stdint.h>
+
+extern volatile uint8_t DDRC, PORTC, DDRD, DIDR0; 
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1; 
+extern volatile uint16_t ICR1, OCR1A, TCNT1; 
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB; 
+extern volatile uint16_t ADC; 
+
+//Bits (ATmega168) 
+#define WGM11 1
+#define COM1A1 7
+#define WGM12 3
+#define WGM13 4
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define TOIE1 0
+#define TOV1 0
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
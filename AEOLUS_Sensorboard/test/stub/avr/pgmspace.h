@@ -0,0 +1,9 @@
+/*
+ * Host stub of <avr/pgmspace.h> (the flash is ordinary memory on the host) 
+ */ 
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
@@ -0,0 +1,5 @@
+/*
+ * Host stub of <util/atomic.h> (there are no interrupts on the host) 
+ */ 
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for(uint8_t atomic_once = 1; atomic_once; atomic_once = 0)
@@ -0,0 +1,26 @@
+/*
+ * Host stub of <util/crc16.h> (C versions given in the avr-libc documentation) 
+ */ 
+#include <stdint.h>
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+	
+	crc = crc ^ ((uint16_t)data << 8); 
+	for(uint8_t i = 0; i < 8; i++) {
+		if(crc & 0x8000) {
+			crc = (crc << 1) ^ 0x1021; 
+		} else {
+			crc <<= 1; 
+		}
+	}
+	
+	return crc; 
+}
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+	
+	data ^= (uint8_t)crc; 
+	data ^= data << 4; 
+	
+	return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3)); 
+}
@@ -0,0 +1,5 @@
+/*
+ * Host stub of <util/delay.h> (the tests do not wait) 
+ */ 
+#define _delay_ms(ms) ((void)(ms))
+#define _delay_us(us) ((void)(us))
@@ -0,0 +1,159 @@
+/*
+ * test_mavlink.c
+ *
+ * Host test of the MAVLink output (compiled with PIXHAWK_OUTPUT == PIXHAWK_MAVLINK): the frame sent for the small
+ * Matrix of obstacle_distance_vector.h must match the frame packed by pymavlink byte by byte.
+ * The transmit buffer is simulated with TX_ROOM bytes being sent between two calls of pixhawk_handler() => the
+ * frame has to be produced in several parts and must never overflow the buffer.
+ * The modules used by pixhawk.c are replaced by the stubs below.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "pixhawk.h"
+#include "serial.h"
+#include "measure.h"
+#include "obstacles.h"
+#include "timer.h"
+#include "lidar.h"
+#include "port.h"
+
+#include "obstacle_distance_vector.h"
+
+#if PIXHAWK_OUTPUT != PIXHAWK_MAVLINK
+	#error "The test needs PIXHAWK_OUTPUT == PIXHAWK_MAVLINK"
+#endif
+
+#define TX_ROOM 32			//Bytes sent by the UART between two calls of the handler
+
+static uint8_t sent[256];	//Bytes written to the serial interface
+static uint16_t sent_length;
+static uint8_t room;		//Free space in the transmit buffer [bytes]
+static uint16_t overflow;	//Bytes written to a full transmit buffer
+
+
+
+/************************************************************************/
+/* S T U B S                                                            */
+/************************************************************************/
+
+void serial_send_byte(uint8_t data) {
+
+	if(sent_length < sizeof(sent)) {
+		sent[sent_length] = data;
+	}
+
+	sent_length++;
+
+	if(room > 0) {
+		room--;
+	} else {
+		overflow++;
+	}
+}
+
+uint8_t serial_tx_free(void) {
+
+	return room;
+}
+
+bool serial_tx_busy(void) {
+
+	return false;
+}
+
+uint16_t measure_get_distance_small(uint16_t ind) {
+
+	return vector_matrix[ind];
+}
+
+uint32_t timer_get_ms(void) {
+
+	return VECTOR_TIME_MS;
+}
+
+bool serial_init(uint32_t baud) { return true; }
+bool serial_set_baud(uint32_t baud) { return true; }
+int16_t serial_baud_error(uint32_t baud) { return 0; }
+uint8_t serial_receive(uint8_t *data, uint8_t n) { return 0; }
+bool measure_init(void) { return true; }
+bool measure_calibrate(void) { return true; }
+uint16_t measure_get_distance(uint16_t angle) { return 0; }
+uint16_t measure_get_heading_valid(void) { return 0; }
+bool measure_set_threshold(uint16_t threshold) { return true; }
+void obstacles_init(void) { }
+uint8_t obstacles_get_count(void) { return 0; }
+uint8_t obstacles_sort(void) { return 0; }
+const obstacle *obstacles_get(uint8_t index) { return NULL; }
+uint16_t lidar_get_distance(uint8_t id) { return 0; }
+void port_led(bool state) { }
+
+
+/**
+ * Push a sector and call the handler until the frame is sent
+ *
+ * @return Number of calls of the handler, which sent a part of the frame
+ */
+uint16_t send_frame(void) {
+
+	uint16_t calls = 0;
+
+	pixhawk_push_sector(0, 1);
+
+	while(true) {
+		uint16_t length = sent_length;
+
+		room = TX_ROOM;
+		pixhawk_handler();
+
+		if(sent_length == length) {
+			return calls;
+		}
+
+		calls++;
+	}
+}
+
+
+
+/************************************************************************/
+/* T E S T                                                              */
+/************************************************************************/
+
+int main(void) {
+
+	//The sequence number counts the frames sent => skip to the one of the vector
+	for(uint8_t i = 0; i < VECTOR_SEQ; i++) {
+		send_frame();
+	}
+
+	sent_length = 0;
+	uint16_t calls = send_frame();
+
+	if(overflow > 0) {
+		printf("FAIL: %u bytes written to the full transmit buffer\n", overflow);
+		return 1;
+	}
+
+	if(calls < 2) {
+		printf("FAIL: the frame was sent at once\n");
+		return 1;
+	}
+
+	if(sent_length != sizeof(vector_frame)) {
+		printf("FAIL: %u bytes sent, %u expected\n", sent_length, (unsigned)sizeof(vector_frame));
+		return 1;
+	}
+
+	for(uint16_t i = 0; i < sent_length; i++) {
+		if(sent[i] != vector_frame[i]) {
+			printf("FAIL: byte %u is 0x%02x, 0x%02x expected\n", i, sent[i], vector_frame[i]);
+			return 1;
+		}
+	}
+
+	printf("PASS: OBSTACLE_DISTANCE (%u bytes in %u parts)\n", sent_length, calls);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * test_servo.c
+ *
+ * Host test of the position feedback of the servo (compiled with SERVO_FEEDBACK == 1):
+ * feedback2angle() at the ends and the middle of the potentiometer and servo_is_settled() at the border
+ * of FEEDBACK_TOLERANCE and of FEEDBACK_TIMEOUT. The ADC is mocked by setting its register and running the conversion interrupt.
+ * The continuous sweep is run for more than 2^32us: the angle commanded by the Timer1 interrupt must match 
+ * the angle calculated from the time (used for the measurements). 
+ */
+
+#include <stdio.h>
+
+#include <avr/io.h>
+
+#include "config.h"
+#include "servo.h"
+#include "timer.h"
+
+#if SERVO_FEEDBACK != 1
+	#error "The test needs SERVO_FEEDBACK == 1"
+#endif
+
+/* @brief Functions under test (private in servo.c) */
+uint16_t feedback2angle(uint16_t adc);
+uint16_t sweep_angle(uint32_t time);
+uint16_t pwm(uint16_t angle);
+void ADC_vect(void);
+void TIMER1_OVF_vect(void);
+
+
+//Registers used by servo.c
+volatile uint8_t DDRC, PORTC, DDRD, DIDR0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t ICR1, OCR1A, TCNT1;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+volatile uint16_t ADC;
+
+static uint32_t now = 1000000;	//System time [us]
+static uint8_t failed = 0;
+
+#define CHECK(cond) do { \
+	if(!(cond)) { \
+		printf("FAIL: line %d: %s\n", __LINE__, #cond); \
+		failed++; \
+	} \
+} while(0)
+
+
+
+/************************************************************************/
+/* S T U B S                                                            */
+/************************************************************************/
+
+uint32_t timer_get_ms(void) {
+
+	return now/1000;
+}
+
+uint32_t timer_get_us(void) {
+
+	return now;
+}
+
+
+/**
+ * Let the ADC convert the same value until the filter of the interrupt settled
+ *
+ * @param value: ADC value of the potentiometer
+ */
+void adc_set(uint16_t value) {
+
+	ADC = value;
+
+	for(uint8_t i = 0; i < 100; i++) {
+		ADC_vect();
+	}
+}
+
+
+/**
+ * Command an angle relative to the measured position of the servo and check, if it is settled
+ * Note: The time of the modeled arrival is not reached => only the feedback decides
+ *
+ * @param adc: ADC value of the potentiometer
+ * @param offset: measured angle minus commanded angle [1/ANGLE_RES °]
+ * @return servo_is_settled()
+ */
+bool settled_at(uint16_t adc, int16_t offset) {
+
+	adc_set(adc);
+	servo_set(feedback2angle(adc) - offset);
+
+	return servo_is_settled();
+}
+
+
+
+/************************************************************************/
+/* T E S T                                                              */
+/************************************************************************/
+
+int main(void) {
+
+	servo_init();
+
+	//FEEDBACK2ANGLE
+	CHECK(feedback2angle(0) == 0);
+	CHECK(feedback2angle(FEEDBACK_MIN) == 0);
+	CHECK(feedback2angle((FEEDBACK_MIN + FEEDBACK_MAX)/2) == DEG(90));
+	CHECK(feedback2angle(FEEDBACK_MAX) == DEG(180));
+	CHECK(feedback2angle(1023) == DEG(180));
+
+	//The filtered ADC value is used as position
+	adc_set((FEEDBACK_MIN + FEEDBACK_MAX)/2);
+	CHECK(servo_get_position() == DEG(90));
+
+	//SERVO_IS_SETTLED
+	uint16_t adc = (FEEDBACK_MIN + FEEDBACK_MAX)/2;
+
+	CHECK(settled_at(adc, 0));
+	CHECK(settled_at(adc, FEEDBACK_TOLERANCE));
+	CHECK(settled_at(adc, -FEEDBACK_TOLERANCE));
+	CHECK(!settled_at(adc, FEEDBACK_TOLERANCE + 1));
+	CHECK(!settled_at(adc, -FEEDBACK_TOLERANCE - 1));
+
+	//A servo that does not reach the tolerance is settled FEEDBACK_TIMEOUT after the modeled arrival
+	uint32_t start = now;
+	uint16_t time = servo_set(DEG(45));
+	CHECK(!servo_is_settled());
+	now = start + (time + FEEDBACK_TIMEOUT - 1)*1000UL;
+	CHECK(!servo_is_settled());
+	now = start + (time + FEEDBACK_TIMEOUT)*1000UL;
+	CHECK(servo_is_settled());
+
+	//CONTINUOUS SWEEP
+	//Timer1 overflows 20ms after the start, the sweep starts as soon as the servo reached the start angle
+	TCNT1 = 0;
+	CHECK(servo_sweep_start(0, DEG(180), 90));
+
+	uint32_t mismatch = 0;
+	uint16_t lo = 0xFFFF, hi = 0;
+
+	now += 20000;
+
+	for(uint32_t i = 0; i < 300000; i++, now += 20000) {
+		TIMER1_OVF_vect();
+
+		if(OCR1A != pwm(sweep_angle(now))) {
+			mismatch++;
+		}
+
+		if(i > 250000) {
+			//Later than 2^32us
+			uint16_t angle = sweep_angle(now);
+			lo = (angle < lo) ? angle : lo;
+			hi = (angle > hi) ? angle : hi;
+		}
+	}
+
+	CHECK(mismatch == 0);
+	CHECK(lo == 0 && hi == DEG(180));
+
+	servo_sweep_stop();
+
+	if(failed > 0) {
+		return 1;
+	}
+
+	printf("PASS: servo feedback\n");
+	return 0;
+}
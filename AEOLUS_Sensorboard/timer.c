@@ -0,0 +1,125 @@
+/*
+ * timer.c
+ *
+ * This file implements the system time using Timer0. The timer runs in CTC-Mode and generates 
+ * an interrupt every millisecond. The microseconds are taken from the counter register. 
+ *
+ * Note: Timer1 is used for the PWM of the servo and can not be used here. 
+ *       Time differences must be calculated by subtraction (now - start) to handle the overflow correctly. 
+ *
+ * Created: 17.10.2026 09:12:30
+ */ 
+
+#include "config.h"
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+
+/************************************************************************/
+/* V A R I A B L E S                                                    */
+/************************************************************************/
+
+#define PRESCALER 64								//Prescaler of Timer0 
+#define TICKS_PER_MS (F_CPU/PRESCALER/1000)			//Timer counts per millisecond (125 at 8MHz) 
+
+#if TICKS_PER_MS > 256
+	#error "Timer0 can not count one millisecond with the current F_CPU"
+#endif
+
+static volatile uint32_t ms = 0;	//Milliseconds since the timer was started 
+
+
+
+
+/************************************************************************/
+/* P U B L I C    F U N C T I O N S                                     */
+/************************************************************************/
+
+/**
+ * Init the system timer
+ * Note: Interrupts must be enabled for the timer to run 
+ *
+ * @return true, if initialization was successful 
+ */
+bool timer_init(void) {
+	
+	ms = 0; 
+	
+	//CTC-Mode: the counter is reset as soon as it reaches OCR0A 
+	TCCR0A = (1<<WGM01); 
+	OCR0A = TICKS_PER_MS - 1; 
+	TCNT0 = 0; 
+	
+	//Use prescaler of 64 => F_CPU/64
+	TCCR0B = (1<<CS01) | (1<<CS00); 
+	
+	//Allow compare match interrupts 
+	TIMSK0 |= (1<<OCIE0A); 
+	
+	return true; 
+}
+
+
+
+/**
+ * Get the time since boot 
+ *
+ * @return time [ms] 
+ */
+uint32_t timer_get_ms(void) {
+	
+	uint32_t ret; 
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ret = ms; 
+	}
+	
+	return ret; 
+}
+
+
+
+/**
+ * Get the time since boot with a resolution of one timer count (8us at 8MHz)
+ * Note: The value overflows after about 71 minutes 
+ *
+ * @return time [us] 
+ */
+uint32_t timer_get_us(void) {
+	
+	uint32_t ret_ms; 
+	uint8_t ticks; 
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		
+		ret_ms = ms; 
+		ticks = TCNT0; 
+		
+		//The counter was reset, but the interrupt was not executed yet 
+		if((TIFR0 & (1<<OCF0A)) && ticks < TICKS_PER_MS-1) {
+			ret_ms++; 
+		}
+	}
+	
+	return ret_ms*1000 + (uint32_t)ticks*1000/TICKS_PER_MS; 
+}
+
+
+
+
+/************************************************************************/
+/* I N T E R R U P T    H A N D L E R S                                 */
+/************************************************************************/
+
+/**
+ * Compare Match Interrupt of Timer0 
+ * This interrupt occurs every millisecond. 
+ */
+ISR(TIMER0_COMPA_vect) {
+	
+	ms++; 
+}
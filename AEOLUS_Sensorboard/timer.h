@@ -0,0 +1,25 @@
+/*
+ * timer.h
+ *
+ * Created: 17.10.2026 09:12:41
+ */ 
+
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* @brief Init the system timer */ 
+bool timer_init(void); 
+
+/* @brief Get the time since boot in milliseconds */ 
+uint32_t timer_get_ms(void); 
+
+/* @brief Get the time since boot in microseconds */ 
+uint32_t timer_get_us(void); 
+
+
+#endif /* TIMER_H_ */